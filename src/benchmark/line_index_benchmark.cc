@@ -0,0 +1,116 @@
+// Compares building the row table of a file with the old ReadLine loop and
+// with the line indexer, on one thread per scanner and on all cores.
+//
+// Usage: line_index_benchmark <file> [runs]
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+#include "wx/init.h"
+#include "wx/stopwatch.h"
+#include "wx/string.h"
+#include "wx/txtstrm.h"
+#include "wx/wfstream.h"
+
+#include "notepad/line_indexer.h"
+#include "notepad/mapped_file.h"
+
+using csi_training::IndexLines;
+using csi_training::IsLineScannerSupported;
+using csi_training::LineIndex;
+using csi_training::LineScanner;
+using csi_training::MappedFile;
+
+namespace {
+
+void Report(const char* name, size_t lines, long ms, size_t bytes) {  // NOLINT
+  double mb = bytes / (1024.0 * 1024.0);
+  double seconds = ms > 0 ? ms / 1000.0 : 0.001;
+  printf("%-24s %10zu lines %8ld ms %10.1f MB/s\n",
+         name, lines, ms, mb / seconds);
+}
+
+// The loop TextBuffer::DoLoadFile used to run.
+void RunReadLine(const wxString& path, size_t bytes, int runs) {
+  long best = -1;  // NOLINT
+  size_t lines = 0;
+  for (int i = 0; i < runs; ++i) {
+    wxStopWatch watch;
+    wxFileInputStream file_input(path);
+    wxTextInputStream text_input(file_input);
+    lines = 0;
+    while (!file_input.Eof()) {
+      wxString line = text_input.ReadLine();
+      ++lines;
+    }
+    long ms = watch.Time();  // NOLINT
+    if (best < 0 || ms < best) {
+      best = ms;
+    }
+  }
+  Report("ReadLine", lines, best, bytes);
+}
+
+void RunIndexer(const char* name,
+                const MappedFile& file,
+                LineScanner scanner,
+                int thread_count,
+                int runs) {
+  if (!IsLineScannerSupported(scanner)) {
+    printf("%-24s not supported\n", name);
+    return;
+  }
+
+  long best = -1;  // NOLINT
+  size_t lines = 0;
+  for (int i = 0; i < runs; ++i) {
+    LineIndex index;
+    wxStopWatch watch;
+    IndexLines(file.data(), file.size(), &index, scanner, thread_count);
+    long ms = watch.Time();  // NOLINT
+    lines = index.line_feeds.size() + 1;
+    if (best < 0 || ms < best) {
+      best = ms;
+    }
+  }
+  Report(name, lines, best, file.size());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  wxInitializer initializer;
+  if (!initializer) {
+    fprintf(stderr, "Failed to initialize wxWidgets.\n");
+    return 1;
+  }
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <file> [runs]\n", argv[0]);
+    return 1;
+  }
+
+  wxString path(argv[1]);
+  int runs = argc > 2 ? atoi(argv[2]) : 3;
+
+  MappedFile file;
+  if (!file.Open(path)) {
+    fprintf(stderr, "Failed to open %s.\n", argv[1]);
+    return 1;
+  }
+
+  // Touch every page first so all runs read from the page cache.
+  LineIndex warm_up;
+  IndexLines(file.data(), file.size(), &warm_up);
+
+  int cores = std::thread::hardware_concurrency();
+  printf("%s: %zu bytes, %d cores\n", argv[1], file.size(), cores);
+
+  RunReadLine(path, file.size(), runs);
+  RunIndexer("scalar, 1 thread", file, csi_training::kScalarScanner, 1, runs);
+  RunIndexer("SSE2, 1 thread", file, csi_training::kSse2Scanner, 1, runs);
+  RunIndexer("AVX2, 1 thread", file, csi_training::kAvx2Scanner, 1, runs);
+  RunIndexer("best, all cores", file, csi_training::kBestScanner, 0, runs);
+  return 0;
+}
@@ -0,0 +1,105 @@
+// Measures TextPanel::Paint() for a window sized view at the top and in the
+// middle of documents of growing size, and painting every row once for
+// comparison. The view should cost the same for any document size.
+//
+// Usage: paint_benchmark [paints]
+
+#include <cstdio>
+
+#include "wx/app.h"
+#include "wx/bitmap.h"
+#include "wx/dcmemory.h"
+#include "wx/ffile.h"
+#include "wx/filefn.h"
+#include "wx/filename.h"
+#include "wx/frame.h"
+#include "wx/stopwatch.h"
+
+#include "notepad/task_scheduler.h"
+#include "notepad/text_buffer.h"
+#include "notepad/text_panel.h"
+
+using csi_training::TaskScheduler;
+using csi_training::TextBuffer;
+using csi_training::TextPanel;
+
+namespace {
+
+const int kViewWidth = 800;
+const int kViewHeight = 600;
+
+// Writes a file of row_count rows of about 60 chars.
+bool WriteRows(const wxString& path, int row_count) {
+  wxFFile file(path, wxT("wb"));
+  if (!file.IsOpened()) {
+    return false;
+  }
+  char row[128];
+  for (int i = 0; i < row_count; ++i) {
+    int len = snprintf(row, sizeof(row),
+                       "%8d: the quick brown fox jumps over the lazy dog\n",
+                       i);
+    file.Write(row, len);
+  }
+  return file.Close();
+}
+
+// Gets the milliseconds per paint of rect.
+double TimePaint(TextPanel* panel, wxDC& dc, const wxRect& rect, int paints) {
+  wxStopWatch watch;
+  for (int i = 0; i < paints; ++i) {
+    panel->Paint(dc, rect);
+  }
+  return static_cast<double>(watch.Time()) / paints;
+}
+
+}  // namespace
+
+class PaintBenchmarkApp : public wxApp {
+ public:
+  bool OnInit() override { return true; }
+  int OnRun() override;
+};
+
+IMPLEMENT_APP(PaintBenchmarkApp)
+
+int PaintBenchmarkApp::OnRun() {
+  int paints = argc > 1 ? wxAtoi(argv[1]) : 100;
+
+  TaskScheduler scheduler;
+  wxFrame* frame = new wxFrame(nullptr, wxID_ANY, wxT("paint_benchmark"));
+  wxBitmap bitmap(kViewWidth, kViewHeight);
+  wxMemoryDC dc(bitmap);
+
+  printf("%10s %12s %12s %12s\n", "rows", "top ms", "middle ms", "all ms");
+  const int row_counts[] = { 1000, 10000, 100000, 1000000 };
+  for (int row_count : row_counts) {
+    wxString path = wxFileName::CreateTempFileName(wxT("paint_benchmark"));
+    if (path.empty() || !WriteRows(path, row_count)) {
+      fprintf(stderr, "Failed to write the rows.\n");
+      return 1;
+    }
+
+    TextBuffer buffer;
+    buffer.DoLoadFile(path);
+    TextPanel* panel = new TextPanel(&buffer, &scheduler, frame);
+    panel->SetSize(wxSize(kViewWidth, kViewHeight));
+    panel->UpdateVirtualSize();
+
+    int height = panel->GetVirtualSize().GetHeight();
+    wxRect top(0, 0, kViewWidth, kViewHeight);
+    wxRect middle(0, height / 2, kViewWidth, kViewHeight);
+    wxRect all(0, 0, kViewWidth, height);
+    double top_ms = TimePaint(panel, dc, top, paints);
+    double middle_ms = TimePaint(panel, dc, middle, paints);
+    double all_ms = TimePaint(panel, dc, all, 1);
+    printf("%10d %12.3f %12.3f %12.1f\n",
+           row_count, top_ms, middle_ms, all_ms);
+
+    panel->Destroy();
+    wxRemoveFile(path);
+  }
+
+  frame->Destroy();
+  return 0;
+}
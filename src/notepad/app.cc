@@ -26,12 +26,29 @@ bool NotepadApp::OnInit() {
     return false;
   }
 
+  scheduler_.reset(new TaskScheduler());
   MyFrame *frame = new MyFrame(wxT("Notepad"));
   frame->Show(true);
 
   return true;
 }
 
+int NotepadApp::OnExit() {
+  // The windows are gone, and so are their tasks.
+  if (scheduler_) {
+    for (const TaskStats& stats : scheduler_->GetStats()) {
+      wxLogDebug("Task %s: %d runs, %d ms, longest %d ms, queued %d ms",
+                 stats.name,
+                 static_cast<int>(stats.count),
+                 static_cast<int>(stats.run_time / 1000),
+                 static_cast<int>(stats.max_run_time / 1000),
+                 static_cast<int>(stats.queued_time / 1000));
+    }
+    scheduler_.reset();
+  }
+  return wxApp::OnExit();
+}
+
 BEGIN_EVENT_TABLE(MyFrame, wxFrame)
 EVT_SIZE(MyFrame::OnSize)
 EVT_MENU(ID_Quit, MyFrame::OnQuit)
@@ -40,26 +57,36 @@ EVT_MENU(ID_New, MyFrame::OnNewFile)
 EVT_MENU(ID_Open, MyFrame::OnOpenFile)
 EVT_MENU(ID_Save, MyFrame::OnSaveFile)
 EVT_MENU(ID_Save_As, MyFrame::OnSaveAsFile)
+EVT_MENU(ID_Cancel_Load, MyFrame::OnCancelLoad)
 EVT_MENU(ID_Undo, MyFrame::OnUndo)
 EVT_MENU(ID_Redo, MyFrame::OnRedo)
 EVT_UPDATE_UI_RANGE(ID_Undo, ID_Redo, MyFrame::OnEditMenuUpdate)
+EVT_MENU(ID_Word_Wrap, MyFrame::OnWordWrap)
+EVT_UPDATE_UI(ID_Save, MyFrame::OnFileMenuUpdate)
+EVT_UPDATE_UI(ID_Save_As, MyFrame::OnFileMenuUpdate)
+EVT_UPDATE_UI(ID_Cancel_Load, MyFrame::OnFileMenuUpdate)
 END_EVENT_TABLE();
 
 MyFrame::MyFrame(const wxString& title)
     : wxFrame(NULL, wxID_ANY, title)
-    , file_path_("") {
+    , file_path_("")
+    , file_saver_(nullptr) {
   // create a menu bar
   wxMenu *file_menu = new wxMenu;
   file_menu->Append(ID_New, "N&ew\tCtrl-N", "New File");
   file_menu->Append(ID_Open, "O&pen...\tCtrl-O", "Open File");
   file_menu->Append(ID_Save, "&Save\tCtrl-S", "Save File");
   file_menu->Append(ID_Save_As, "Sa&ve As...\t", "Save File As");
+  file_menu->Append(ID_Cancel_Load, "S&top Loading\tEsc", "Stop Loading File");
   file_menu->Append(ID_Quit, "E&xit\tAlt-X", "Quit Notepad");
 
   wxMenu *edit_menu = new wxMenu;
   edit_menu->Append(ID_Undo, "&Undo\tCtrl-Z", "Undo");
   edit_menu->Append(ID_Redo, "Red&o\tCtrl-Y", "Redo");
 
+  wxMenu *view_menu = new wxMenu;
+  view_menu->AppendCheckItem(ID_Word_Wrap, "&Word Wrap", "Wrap Long Lines");
+
   // the "About" item should be in the help menu
   wxMenu *help_menu = new wxMenu;
   help_menu->Append(ID_About, "&About\tF1", "Show about notepad");
@@ -68,14 +95,17 @@ MyFrame::MyFrame(const wxString& title)
   wxMenuBar *menu_bar = new wxMenuBar();
   menu_bar->Append(file_menu, "&File");
   menu_bar->Append(edit_menu, "Ed&it");
+  menu_bar->Append(view_menu, "&View");
   menu_bar->Append(help_menu, "&Help");
 
   // ... and attach this menu bar to the frame
   SetMenuBar(menu_bar);
+  CreateStatusBar();
 
   TextBuffer *text_buffer = new TextBuffer();
 
   text_ctrl_ = new TextPanel(text_buffer,
+                             wxGetApp().scheduler(),
                              this,
                              ID_Text,
                              wxDefaultPosition,
@@ -84,6 +114,12 @@ MyFrame::MyFrame(const wxString& title)
                              wxPanelNameStr);
 }
 
+MyFrame::~MyFrame() {
+  // Let a save in progress complete, the file is intact either way but the
+  // user asked for it.
+  WaitForSaver();
+}
+
 void MyFrame::OnSize(wxSizeEvent& evt) {
   wxLogDebug("MyFrame::OnSize");
 
@@ -131,7 +167,7 @@ void MyFrame::OnSaveFile(wxCommandEvent& event) {
   if (file_path_.empty()) {
     OnSaveAsFile(event);
   } else {
-    text_ctrl_->SaveFile(file_path_);
+    SaveFile(file_path_);
   }
 }
 
@@ -150,11 +186,90 @@ void MyFrame::OnSaveAsFile(wxCommandEvent& WXUNUSED(event)) {
     file_path_ = dialog.GetPath();
 
     if (!file_path_.empty()) {
-      text_ctrl_->SaveFile(file_path_);
+      SaveFile(file_path_);
     }
   }
 }
 
+void MyFrame::OnCancelLoad(wxCommandEvent& WXUNUSED(event)) {
+  if (text_ctrl_->IsLoading()) {
+    file_path_ = "";
+    text_ctrl_->CancelLoad();
+  }
+}
+
+void MyFrame::OnFileMenuUpdate(wxUpdateUIEvent& evt) {
+  // Only a completely loaded file can be saved, one save at a time.
+  bool loading = text_ctrl_->IsLoading();
+  if (evt.GetId() == ID_Cancel_Load) {
+    evt.Enable(loading);
+  } else {
+    evt.Enable(!loading && file_saver_ == nullptr);
+  }
+}
+
+void MyFrame::SaveFile(const wxString& file_path) {
+  if (file_saver_ != nullptr) {
+    return;
+  }
+  std::shared_ptr<const TextSnapshot> snapshot = text_ctrl_->TakeSnapshot();
+  if (!snapshot) {
+    return;
+  }
+  // Bytes that are not UTF-8 were read as Latin-1 and are saved as UTF-8.
+  const MappedText* original = snapshot->GetMappedOriginal();
+  if (original != nullptr && !original->is_utf8()
+      && wxMessageBox("The file is not valid UTF-8, saving it converts the "
+                      "bytes that are not. Save anyway?",
+                      "Save File",
+                      wxYES_NO | wxNO_DEFAULT | wxICON_WARNING,
+                      this) != wxYES) {
+    return;
+  }
+
+  file_saver_ = new FileSaver(this,
+                              snapshot,
+                              file_path,
+                              [this](int percent) {
+                                OnSaverProgress(percent);
+                              },
+                              [this](bool saved) { OnSaverDone(saved); });
+  file_saver_->Start(wxGetApp().scheduler());
+  SetStatusText("Saving " + file_path + "...");
+}
+
+void MyFrame::WaitForSaver() {
+  if (file_saver_ != nullptr) {
+    file_saver_->Wait();
+    delete file_saver_;
+    file_saver_ = nullptr;
+  }
+}
+
+void MyFrame::OnSaverProgress(int percent) {
+  if (file_saver_ != nullptr) {
+    SetStatusText(wxString::Format("Saving %s... %d%%",
+                                   file_saver_->file_path(),
+                                   percent));
+  }
+}
+
+void MyFrame::OnSaverDone(bool saved) {
+  if (file_saver_ == nullptr) {
+    return;
+  }
+
+  wxString file_path = file_saver_->file_path();
+  WaitForSaver();
+  if (saved) {
+    SetStatusText("Saved " + file_path);
+  } else {
+    SetStatusText("");
+    wxMessageBox("Failed to save " + file_path, "Save File",
+                 wxOK | wxICON_ERROR, this);
+  }
+}
+
 void MyFrame::OnUndo(wxCommandEvent& WXUNUSED(event)) {
   if (CanUndo())
     text_ctrl_->DoUndo();
@@ -176,6 +291,10 @@ void MyFrame::OnEditMenuUpdate(wxUpdateUIEvent& evt) {
   evt.Enable(state);
 }
 
+void MyFrame::OnWordWrap(wxCommandEvent& event) {
+  text_ctrl_->SetWordWrap(event.IsChecked());
+}
+
 bool MyFrame::CanUndo() {
   return text_ctrl_->CanUndo();
 }
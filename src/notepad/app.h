@@ -1,11 +1,15 @@
 #ifndef NOTEPAD_NOTEPAD_APP_H_
 #define NOTEPAD_NOTEPAD_APP_H_
 
+#include <memory>
+
 #include "wx/app.h"
 #include "wx/event.h"
 #include "wx/frame.h"
 #include "wx/string.h"
 
+#include "notepad/file_saver.h"
+#include "notepad/task_scheduler.h"
 #include "notepad/text_panel.h"
 
 namespace csi_training {
@@ -20,6 +24,13 @@ class NotepadApp : public wxApp {
   virtual ~NotepadApp();
 
   virtual bool OnInit();
+  virtual int OnExit();
+
+  // Runs the background work of all the windows.
+  TaskScheduler* scheduler() { return scheduler_.get(); }
+
+ private:
+  std::unique_ptr<TaskScheduler> scheduler_;
 };
 
 DECLARE_APP(NotepadApp)
@@ -33,7 +44,9 @@ enum {
   ID_Save = 103,
   ID_Save_As = 104,
   ID_Undo = 105,
-  ID_Redo = 106
+  ID_Redo = 106,
+  ID_Cancel_Load = 107,
+  ID_Word_Wrap = 108
 };
 
 class MyFrame : public wxFrame {
@@ -41,6 +54,7 @@ class MyFrame : public wxFrame {
 
  public:
   explicit MyFrame(const wxString& title);
+  virtual ~MyFrame();
 
   void OnSize(wxSizeEvent& evt);  // NOLINT
   void OnQuit(wxCommandEvent&event);  // NOLINT
@@ -49,17 +63,30 @@ class MyFrame : public wxFrame {
   void OnOpenFile(wxCommandEvent&event);  // NOLINT
   void OnSaveFile(wxCommandEvent&event);  // NOLINT
   void OnSaveAsFile(wxCommandEvent&event);  // NOLINT
+  void OnCancelLoad(wxCommandEvent&event);  // NOLINT
+  void OnFileMenuUpdate(wxUpdateUIEvent& evt);  // NOLINT
 
   void OnUndo(wxCommandEvent&event);  // NOLINT
   void OnRedo(wxCommandEvent&event);  // NOLINT
   void OnEditMenuUpdate(wxUpdateUIEvent& evt);  // NOLINT
+  void OnWordWrap(wxCommandEvent&event);  // NOLINT
 
   bool CanUndo();
   bool CanRedo();
 
+ private:
+  // Saves a snapshot of the text in the background, the progress is shown
+  // in the status bar.
+  void SaveFile(const wxString& file_path);
+  void OnSaverProgress(int percent);
+  void OnSaverDone(bool saved);
+  // Waits for the file saver, if any, to finish.
+  void WaitForSaver();
+
  private:
   TextPanel* text_ctrl_;
   wxString file_path_;
+  FileSaver* file_saver_;
 };
 
 }  // namespace csi_training
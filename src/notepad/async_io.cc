@@ -0,0 +1,496 @@
+#include "notepad/async_io.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define NOTEPAD_HAS_IO_URING 1
+#endif
+#endif
+
+#ifdef __UNIX__
+#include <unistd.h>
+#endif
+
+#ifdef NOTEPAD_HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace csi_training {
+
+#ifdef NOTEPAD_HAS_IO_URING
+
+// The rings shared with the kernel. Only this thread moves the submission
+// tail and the completion head, the kernel moves the others.
+struct AsyncIo::Ring {
+  Ring()
+      : fd(-1)
+      , sq_ptr(MAP_FAILED)
+      , sq_size(0)
+      , cq_ptr(MAP_FAILED)
+      , cq_size(0)
+      , sqes(static_cast<io_uring_sqe*>(MAP_FAILED))
+      , sqes_size(0)
+      , unsubmitted(0)
+      , in_flight(0)
+      , broken(false)
+      , fixed_buffers(false) {
+  }
+
+  ~Ring() {
+    if (sqes != MAP_FAILED) {
+      munmap(sqes, sqes_size);
+    }
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+      munmap(cq_ptr, cq_size);
+    }
+    if (sq_ptr != MAP_FAILED) {
+      munmap(sq_ptr, sq_size);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  unsigned* SqField(unsigned offset) const {
+    return reinterpret_cast<unsigned*>(static_cast<char*>(sq_ptr) + offset);
+  }
+  unsigned* CqField(unsigned offset) const {
+    return reinterpret_cast<unsigned*>(static_cast<char*>(cq_ptr) + offset);
+  }
+
+  // Submits to_submit of the entries queued and waits for min_complete
+  // completions. Returns 0, or the error.
+  int Enter(unsigned to_submit, unsigned min_complete) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+      long submitted = syscall(__NR_io_uring_enter, fd, to_submit,  // NOLINT
+                               min_complete, flags, nullptr, 0);
+      if (submitted >= 0) {
+        unsubmitted -= static_cast<unsigned>(submitted);
+        return 0;
+      }
+      if (errno != EINTR) {
+        return errno;
+      }
+    }
+  }
+
+  int fd;
+  io_uring_params params;
+  void* sq_ptr;
+  size_t sq_size;
+  void* cq_ptr;
+  size_t cq_size;
+  io_uring_sqe* sqes;
+  size_t sqes_size;
+  // The entries queued but not submitted yet, the last ones before the
+  // submission tail.
+  unsigned unsubmitted;
+  // The entries queued or submitted whose completion isn't reaped yet.
+  unsigned in_flight;
+  // Set once entering fails. The kernel may still use the memory of the
+  // requests it took, they are drained before the ring is unmapped.
+  bool broken;
+  bool fixed_buffers;
+  // The iovec of each request for the vectored ops, which unlike the plain
+  // ones all kernels with io_uring have.
+  std::vector<iovec> iovecs;
+};
+
+#else
+
+struct AsyncIo::Ring {
+};
+
+#endif
+
+AsyncIo::AsyncIo(wxFile* file,
+                 TaskScheduler* scheduler,
+                 size_t queue_depth,
+                 size_t buffer_size)
+    : file_(file)
+    , scheduler_(scheduler)
+    , buffer_size_(buffer_size)
+    , buffer_memory_(new char[queue_depth * buffer_size])
+    , requests_(queue_depth) {
+  for (size_t i = queue_depth; i > 0; --i) {
+    free_buffers_.push_back(buffer_memory_.get() + (i - 1) * buffer_size_);
+    free_requests_.push_back(i - 1);
+  }
+  if (!SetUpRing(queue_depth)) {
+    ring_.reset();
+  }
+}
+
+AsyncIo::~AsyncIo() {
+  WaitAll();
+}
+
+char* AsyncIo::GetBuffer() {
+  while (free_buffers_.empty()) {
+    WaitOne();
+  }
+  char* buffer = free_buffers_.back();
+  free_buffers_.pop_back();
+  return buffer;
+}
+
+void AsyncIo::ReleaseBuffer(char* buffer) {
+  free_buffers_.push_back(buffer);
+}
+
+void AsyncIo::Read(char* data, size_t size, uint64_t offset, DoneFunc done) {
+  Submit(false, data, size, offset, std::move(done));
+}
+
+void AsyncIo::Write(const char* data,
+                    size_t size,
+                    uint64_t offset,
+                    DoneFunc done) {
+  // The data is only read.
+  Submit(true, const_cast<char*>(data), size, offset, std::move(done));
+}
+
+void AsyncIo::Reap() {
+#ifdef NOTEPAD_HAS_IO_URING
+  if (ring_) {
+    const io_uring_params& params = ring_->params;
+    unsigned* head_ptr = ring_->CqField(params.cq_off.head);
+    unsigned mask = *ring_->CqField(params.cq_off.ring_mask);
+    io_uring_cqe* cqes = reinterpret_cast<io_uring_cqe*>(
+        static_cast<char*>(ring_->cq_ptr) + params.cq_off.cqes);
+    // The head is read again for every entry, handling one may reap more.
+    while (true) {
+      unsigned head = *head_ptr;
+      unsigned tail = __atomic_load_n(ring_->CqField(params.cq_off.tail),
+                                      __ATOMIC_ACQUIRE);
+      if (head == tail) {
+        break;
+      }
+      const io_uring_cqe& cqe = cqes[head & mask];
+      size_t request = static_cast<size_t>(cqe.user_data);
+      int64_t result = cqe.res;
+      // The entry is free for the kernel before it is handled, handling it
+      // may send a request again.
+      __atomic_store_n(head_ptr, head + 1, __ATOMIC_RELEASE);
+      --ring_->in_flight;
+      Complete(request, result);
+    }
+  }
+#endif
+  while (!pending_.empty()) {
+    Request& request = requests_[pending_.front()];
+    if (request.task && !request.task->IsDone()) {
+      return;
+    }
+    size_t index = pending_.front();
+    pending_.pop_front();
+    Finish(index, request.result);
+  }
+}
+
+void AsyncIo::WaitAll() {
+  while (free_requests_.size() < requests_.size()) {
+    WaitOne();
+  }
+}
+
+void AsyncIo::Submit(bool write,
+                     char* data,
+                     size_t size,
+                     uint64_t offset,
+                     DoneFunc done) {
+  while (free_requests_.empty()) {
+    WaitOne();
+  }
+  size_t index = free_requests_.back();
+  free_requests_.pop_back();
+
+  Request& request = requests_[index];
+  request.data = data;
+  request.size = size;
+  request.offset = offset;
+  request.write = write;
+  request.buffer = -1;
+  if (data >= buffer_memory_.get()
+      && data < buffer_memory_.get() + requests_.size() * buffer_size_) {
+    request.buffer = static_cast<int>((data - buffer_memory_.get())
+                                      / buffer_size_);
+  }
+  request.transferred = 0;
+  request.done = std::move(done);
+  request.task.reset();
+  request.result = 0;
+  Start(index);
+}
+
+void AsyncIo::Start(size_t index) {
+  Request& request = requests_[index];
+#ifdef NOTEPAD_HAS_IO_URING
+  if (ring_ && !ring_->broken) {
+    const io_uring_params& params = ring_->params;
+    unsigned* tail_ptr = ring_->SqField(params.sq_off.tail);
+    unsigned mask = *ring_->SqField(params.sq_off.ring_mask);
+    unsigned tail = *tail_ptr;
+    unsigned slot = tail & mask;
+
+    char* data = request.data + request.transferred;
+    size_t size = request.size - request.transferred;
+    io_uring_sqe* sqe = &ring_->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = file_->fd();
+    sqe->off = request.offset + request.transferred;
+    sqe->user_data = index;
+    if (ring_->fixed_buffers && request.buffer >= 0) {
+      sqe->opcode = request.write ? IORING_OP_WRITE_FIXED
+                                  : IORING_OP_READ_FIXED;
+      sqe->addr = reinterpret_cast<uint64_t>(data);
+      sqe->len = static_cast<uint32_t>(size);
+      sqe->buf_index = static_cast<uint16_t>(request.buffer);
+    } else {
+      iovec& iov = ring_->iovecs[index];
+      iov.iov_base = data;
+      iov.iov_len = size;
+      sqe->opcode = request.write ? IORING_OP_WRITEV : IORING_OP_READV;
+      sqe->addr = reinterpret_cast<uint64_t>(&iov);
+      sqe->len = 1;
+    }
+    ring_->SqField(params.sq_off.array)[slot] = slot;
+    __atomic_store_n(tail_ptr, tail + 1, __ATOMIC_RELEASE);
+    ++ring_->unsubmitted;
+    ++ring_->in_flight;
+
+    // Sent right away so the device starts on it. If the kernel is short of
+    // resources it stays queued, WaitOne() sends it again.
+    int error = ring_->Enter(ring_->unsubmitted, 0);
+    if (error != 0 && error != EAGAIN && error != EBUSY) {
+      BreakRing();
+    }
+    return;
+  }
+#endif
+  if (scheduler_ != nullptr) {
+    request.task = scheduler_->Submit(
+        "file io",
+        kTaskPriorityBackground,
+        [this, index](const Task&) {
+          requests_[index].result = Transfer(requests_[index]);
+        });
+  } else {
+    request.result = Transfer(request);
+  }
+  pending_.push_back(index);
+}
+
+int64_t AsyncIo::Transfer(const Request& request) {
+  size_t transferred = 0;
+  while (transferred < request.size) {
+    char* data = request.data + transferred;
+    size_t size = request.size - transferred;
+    uint64_t offset = request.offset + transferred;
+#ifdef __UNIX__
+    int64_t n = request.write ? pwrite(file_->fd(), data, size, offset)
+                              : pread(file_->fd(), data, size, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+#else
+    int64_t n = -1;
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    if (file_->Seek(static_cast<wxFileOffset>(offset)) != wxInvalidOffset) {
+      n = request.write ? file_->Write(data, size) : file_->Read(data, size);
+    }
+#endif
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      // The file ends, or a write made no progress.
+      return request.write ? -1 : static_cast<int64_t>(transferred);
+    }
+    transferred += static_cast<size_t>(n);
+  }
+  return static_cast<int64_t>(transferred);
+}
+
+void AsyncIo::Complete(size_t index, int64_t result) {
+  Request& request = requests_[index];
+  if (result == -EINTR || result == -EAGAIN) {
+    Start(index);
+    return;
+  }
+  if (result < 0) {
+    Finish(index, -1);
+    return;
+  }
+  request.transferred += static_cast<size_t>(result);
+  if (result == 0 || request.transferred == request.size) {
+    if (result == 0 && request.write) {
+      Finish(index, -1);
+    } else {
+      Finish(index, static_cast<int64_t>(request.transferred));
+    }
+    return;
+  }
+  Start(index);
+}
+
+void AsyncIo::Finish(size_t index, int64_t result) {
+  Request& request = requests_[index];
+  DoneFunc done = std::move(request.done);
+  int buffer = request.buffer;
+  request.done = nullptr;
+  request.task.reset();
+  free_requests_.push_back(index);
+
+  if (done) {
+    done(result);
+  }
+  if (buffer >= 0) {
+    free_buffers_.push_back(buffer_memory_.get() + buffer * buffer_size_);
+  }
+}
+
+void AsyncIo::WaitOne() {
+  assert(free_requests_.size() < requests_.size());
+  size_t free_count = free_requests_.size();
+#ifdef NOTEPAD_HAS_IO_URING
+  while (ring_) {
+    Reap();
+    if (free_requests_.size() != free_count) {
+      return;
+    }
+    if (ring_->in_flight == 0) {
+      if (ring_->broken) {
+        // The kernel is done with the requests, the next ones go through
+        // the fallback.
+        ring_.reset();
+      }
+      break;
+    }
+    if (ring_->broken) {
+      // The requests the kernel took complete on their own, their memory
+      // is only given back then.
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    int error = ring_->Enter(ring_->unsubmitted, 1);
+    if (error == EAGAIN || error == EBUSY) {
+      // The kernel is short of resources until requests complete, wait for
+      // one of those it took without sending more.
+      if (ring_->in_flight > ring_->unsubmitted) {
+        error = ring_->Enter(0, 1);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    if (error != 0 && error != EAGAIN && error != EBUSY) {
+      BreakRing();
+    }
+  }
+#endif
+  // The oldest request is run here if no worker has taken it yet.
+  assert(!pending_.empty());
+  Request& request = requests_[pending_.front()];
+  if (request.task) {
+    request.task->Wait();
+  }
+  Reap();
+}
+
+void AsyncIo::BreakRing() {
+#ifdef NOTEPAD_HAS_IO_URING
+  ring_->broken = true;
+  close(ring_->fd);
+  ring_->fd = -1;
+
+  // The kernel never saw the entries not submitted, they are sent again
+  // through the fallback.
+  const io_uring_params& params = ring_->params;
+  unsigned tail = *ring_->SqField(params.sq_off.tail);
+  unsigned mask = *ring_->SqField(params.sq_off.ring_mask);
+  std::vector<size_t> unsubmitted;
+  for (unsigned i = ring_->unsubmitted; i > 0; --i) {
+    unsubmitted.push_back(
+        static_cast<size_t>(ring_->sqes[(tail - i) & mask].user_data));
+  }
+  ring_->in_flight -= ring_->unsubmitted;
+  ring_->unsubmitted = 0;
+  for (size_t index : unsubmitted) {
+    Start(index);
+  }
+#endif
+}
+
+bool AsyncIo::SetUpRing(size_t queue_depth) {
+#ifdef NOTEPAD_HAS_IO_URING
+  ring_.reset(new Ring);
+  memset(&ring_->params, 0, sizeof(ring_->params));
+  ring_->fd = static_cast<int>(syscall(__NR_io_uring_setup,
+                                       static_cast<unsigned>(queue_depth),
+                                       &ring_->params));
+  if (ring_->fd < 0) {
+    return false;
+  }
+
+  const io_uring_params& params = ring_->params;
+  ring_->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring_->cq_size = params.cq_off.cqes
+      + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    ring_->sq_size = ring_->cq_size = std::max(ring_->sq_size,
+                                               ring_->cq_size);
+  }
+  ring_->sq_ptr = mmap(nullptr, ring_->sq_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_->fd,
+                       IORING_OFF_SQ_RING);
+  if (ring_->sq_ptr == MAP_FAILED) {
+    return false;
+  }
+  if (single_mmap) {
+    ring_->cq_ptr = ring_->sq_ptr;
+  } else {
+    ring_->cq_ptr = mmap(nullptr, ring_->cq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_->fd,
+                         IORING_OFF_CQ_RING);
+    if (ring_->cq_ptr == MAP_FAILED) {
+      return false;
+    }
+  }
+  ring_->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  ring_->sqes = static_cast<io_uring_sqe*>(
+      mmap(nullptr, ring_->sqes_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring_->fd, IORING_OFF_SQES));
+  if (ring_->sqes == MAP_FAILED) {
+    return false;
+  }
+  ring_->iovecs.resize(queue_depth);
+
+  // Registering pins the buffers, which the memlock limit may not allow.
+  // The plain ops are used then.
+  std::vector<iovec> buffers(queue_depth);
+  for (size_t i = 0; i < queue_depth; ++i) {
+    buffers[i].iov_base = buffer_memory_.get() + i * buffer_size_;
+    buffers[i].iov_len = buffer_size_;
+  }
+  ring_->fixed_buffers = buffer_size_ > 0
+      && syscall(__NR_io_uring_register, ring_->fd, IORING_REGISTER_BUFFERS,
+                 buffers.data(), static_cast<unsigned>(queue_depth)) == 0;
+  return true;
+#else
+  return false;
+#endif
+}
+
+}  // namespace csi_training
@@ -0,0 +1,123 @@
+#ifndef NOTEPAD_NOTEPAD_ASYNC_IO_H_
+#define NOTEPAD_NOTEPAD_ASYNC_IO_H_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "wx/defs.h"
+#include "wx/file.h"
+
+#include "notepad/task_scheduler.h"
+
+namespace csi_training {
+
+// Reads and writes a file with several requests in flight, so the device
+// stays busy while the caller prepares the next ones. On Linux the requests
+// go through io_uring if the kernel has it, the buffers of the pool are
+// registered with it once so they aren't mapped for every request.
+// Elsewhere, or if io_uring can't be set up, they run as pread/pwrite in
+// tasks of the scheduler, or right away without one.
+// One thread submits the requests, and their done functions are called on
+// it, from the calls that wait.
+class AsyncIo {
+  wxDECLARE_NO_COPY_CLASS(AsyncIo);
+
+ public:
+  // Called with the count of bytes read or written, less only at the end of
+  // the file, or -1 if the request failed.
+  typedef std::function<void(int64_t result)> DoneFunc;
+
+  // At most queue_depth requests are in flight, and there are as many
+  // buffers of buffer_size bytes, 0 for none.
+  AsyncIo(wxFile* file,
+          TaskScheduler* scheduler,
+          size_t queue_depth,
+          size_t buffer_size);
+  // Waits for the requests in flight.
+  ~AsyncIo();
+
+  // Whether the requests go through io_uring.
+  bool IsUring() const { return ring_ != nullptr; }
+  size_t buffer_size() const { return buffer_size_; }
+
+  // Gets a free buffer of the pool, waiting for a request to complete if
+  // there is none. It is given back once the request using it is done.
+  char* GetBuffer();
+  // Gives back a buffer that is not used for a request.
+  void ReleaseBuffer(char* buffer);
+
+  // Reads/writes size bytes at offset into/from data, waiting for a request
+  // to complete first if queue_depth are in flight. data is a buffer of the
+  // pool or memory that stays put until done is called. Short transfers are
+  // continued until all is transferred or the file ends.
+  void Read(char* data, size_t size, uint64_t offset, DoneFunc done);
+  void Write(const char* data, size_t size, uint64_t offset, DoneFunc done);
+
+  // Calls the done functions of the requests completed so far.
+  void Reap();
+  // Waits for all the requests in flight.
+  void WaitAll();
+
+ private:
+  struct Ring;
+
+  struct Request {
+    char* data;
+    size_t size;
+    uint64_t offset;
+    bool write;
+    // The index of the buffer of the pool, -1 for other memory.
+    int buffer;
+    size_t transferred;
+    DoneFunc done;
+    // The task running the request without io_uring, if any, and what it
+    // got.
+    std::shared_ptr<Task> task;
+    int64_t result;
+  };
+
+  void Submit(bool write,
+              char* data,
+              size_t size,
+              uint64_t offset,
+              DoneFunc done);
+  // Sends the part of the request not transferred yet.
+  void Start(size_t request);
+  // Transfers all of the request on this thread, for the fallback.
+  int64_t Transfer(const Request& request);
+  // Takes a result of io_uring, continuing a short transfer.
+  void Complete(size_t request, int64_t result);
+  void Finish(size_t request, int64_t result);
+  // Waits for a request to complete.
+  void WaitOne();
+  // Stops sending requests to io_uring after an error. Those it hasn't
+  // taken are sent through the fallback, WaitOne() drains the others before
+  // their memory is given back and the ring is unmapped.
+  void BreakRing();
+
+  bool SetUpRing(size_t queue_depth);
+
+ private:
+  wxFile* file_;
+  TaskScheduler* scheduler_;
+  size_t buffer_size_;
+  std::unique_ptr<char[]> buffer_memory_;
+  std::vector<char*> free_buffers_;
+
+  std::vector<Request> requests_;
+  std::vector<size_t> free_requests_;
+  // The requests in flight without io_uring, in the order they were sent.
+  std::deque<size_t> pending_;
+  // Seeking and transferring are one step without pread/pwrite.
+  std::mutex file_mutex_;
+
+  std::unique_ptr<Ring> ring_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_ASYNC_IO_H_
@@ -0,0 +1,134 @@
+#include "notepad/char_widths.h"
+
+#include <algorithm>
+
+namespace csi_training {
+
+CharWidths::CharWidths()
+    : fixed_width_(false)
+    , ascii_width_(0) {
+  for (int& width : ascii_widths_) {
+    width = 0;
+  }
+}
+
+void CharWidths::SetFont(const wxFont& font) {
+  dc_.SetFont(font);
+  widths_.clear();
+
+  for (int c = 0; c < 0x80; ++c) {
+    wxChar ch = static_cast<wxChar>(c);
+    ascii_widths_[c] = MeasureChar(&ch, 1);
+  }
+
+  // Trust the font only if the ASCII chars agree.
+  fixed_width_ = font.IsFixedWidth();
+  ascii_width_ = ascii_widths_[static_cast<int>('a')];
+  for (int c = 0x20; c < 0x7F && fixed_width_; ++c) {
+    fixed_width_ = ascii_widths_[c] == ascii_width_;
+  }
+}
+
+int CharWidths::GetWidth(const wxChar* text, size_t len) const {
+  int width = 0;
+  size_t i = 0;
+  if (fixed_width_) {
+    while (i < len && IsPrintableAscii(text[i])) {
+      ++i;
+    }
+    width = static_cast<int>(i) * ascii_width_;
+  }
+
+  while (i < len) {
+    size_t count = 1;
+    width += GetCharWidth(text, len, i, &count);
+    i += count;
+  }
+  return width;
+}
+
+size_t CharWidths::GetCharIndex(const wxChar* text, size_t len, int x) const {
+  if (x <= 0 || len == 0) {
+    return 0;
+  }
+
+  size_t i = 0;
+  int width = 0;
+  if (fixed_width_ && ascii_width_ > 0) {
+    // The nearest column, if all the chars before it are ASCII.
+    size_t column = std::min(
+        static_cast<size_t>((x + ascii_width_ / 2) / ascii_width_), len);
+    while (i < column && IsPrintableAscii(text[i])) {
+      ++i;
+    }
+    if (i == column) {
+      return column;
+    }
+    width = static_cast<int>(i) * ascii_width_;
+  }
+
+  while (i < len) {
+    size_t count = 1;
+    int char_width = GetCharWidth(text, len, i, &count);
+    if (width + char_width / 2 > x) {
+      return i;
+    }
+    width += char_width;
+    i += count;
+  }
+  return len;
+}
+
+void CharWidths::GetPrefixWidths(const wxChar* text,
+                                 size_t len,
+                                 std::vector<int>* widths) const {
+  widths->resize(len + 1);
+  int width = 0;
+  size_t i = 0;
+  while (i < len) {
+    size_t count = 1;
+    int char_width = GetCharWidth(text, len, i, &count);
+    for (size_t j = 0; j < count; ++j) {
+      (*widths)[i + j] = width;
+    }
+    width += char_width;
+    i += count;
+  }
+  (*widths)[len] = width;
+}
+
+int CharWidths::GetCharWidth(const wxChar* text,
+                             size_t len,
+                             size_t i,
+                             size_t* count) const {
+  unsigned int c = static_cast<unsigned int>(text[i]);
+  *count = 1;
+  if (c < 0x80) {
+    return ascii_widths_[c];
+  }
+
+  if (sizeof(wxChar) == 2 && c >= 0xD800 && c <= 0xDBFF && i + 1 < len) {
+    unsigned int low = static_cast<unsigned int>(text[i + 1]);
+    if (low >= 0xDC00 && low <= 0xDFFF) {
+      c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+      *count = 2;
+    }
+  }
+
+  std::unordered_map<unsigned int, int>::const_iterator it = widths_.find(c);
+  if (it != widths_.end()) {
+    return it->second;
+  }
+  int width = MeasureChar(text + i, *count);
+  widths_[c] = width;
+  return width;
+}
+
+int CharWidths::MeasureChar(const wxChar* text, size_t count) const {
+  int width = 0;
+  measure_text_.assign(text, count);
+  dc_.GetTextExtent(measure_text_, &width, nullptr, 0, nullptr);
+  return width;
+}
+
+}  // namespace csi_training
@@ -0,0 +1,64 @@
+#ifndef NOTEPAD_NOTEPAD_CHAR_WIDTHS_H_
+#define NOTEPAD_NOTEPAD_CHAR_WIDTHS_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include "wx/dcmemory.h"
+#include "wx/font.h"
+
+namespace csi_training {
+
+// The advances of the chars of a font. Every char is measured once, text
+// widths are then the sums of the advances of their chars, kerning aside.
+// Printable ASCII text in a fixed width font is pure arithmetic.
+class CharWidths {
+  wxDECLARE_NO_COPY_CLASS(CharWidths);
+
+ public:
+  CharWidths();
+
+  // Sets the font and forgets the advances of the previous one.
+  void SetFont(const wxFont& font);
+
+  bool IsFixedWidth() const { return fixed_width_; }
+  // The advance of the printable ASCII chars if the font is fixed width.
+  int ascii_width() const { return ascii_width_; }
+
+  // Gets the width of the text.
+  int GetWidth(const wxChar* text, size_t len) const;
+
+  // Gets the count of chars of the text before x, x is rounded to the
+  // nearest char boundary.
+  size_t GetCharIndex(const wxChar* text, size_t len, int x) const;
+
+  // Sets (*widths)[i] to the width of the first i chars of the text, for i
+  // in [0, len]. Both halves of a surrogate pair start at the same x.
+  void GetPrefixWidths(const wxChar* text,
+                       size_t len,
+                       std::vector<int>* widths) const;
+
+ private:
+  static bool IsPrintableAscii(wxChar c) { return c >= 0x20 && c < 0x7F; }
+
+  // Gets the advance of the char at text[i] and sets *count to the count
+  // of wxChars it takes, 2 for a surrogate pair.
+  int GetCharWidth(const wxChar* text, size_t len, size_t i,
+                   size_t* count) const;
+
+  int MeasureChar(const wxChar* text, size_t count) const;
+
+ private:
+  mutable wxMemoryDC dc_;
+  bool fixed_width_;
+  int ascii_width_;
+  int ascii_widths_[0x80];
+  // The other chars measured so far, by code point.
+  mutable std::unordered_map<unsigned int, int> widths_;
+  // Measures the chars without allocating once it is big enough.
+  mutable wxString measure_text_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_CHAR_WIDTHS_H_
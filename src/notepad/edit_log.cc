@@ -0,0 +1,129 @@
+#include "notepad/edit_log.h"
+
+namespace csi_training {
+
+static bool IsSpace(wxChar c) {
+  return c == kSpaceChar || c == kTabChar;
+}
+
+EditLog::EditLog()
+    : done_(0)
+    , group_depth_(0)
+    , group_empty_(false)
+    , merge_open_(false) {
+}
+
+void EditLog::Add(ActionType type, size_t offset, bool caret_at_end) {
+  // Drop the undone edits, both vectors hold trivial types so shrinking
+  // them is O(1) and keeps their capacity.
+  records_.resize(done_);
+  text_.resize(GetTextStart(done_));
+
+  Record record;
+  record.text_end = text_.size();
+  record.offset = offset;
+  record.is_insert = type == kInsert ? 1 : 0;
+  record.caret_at_end = caret_at_end ? 1 : 0;
+  record.starts_group = group_depth_ == 0 || group_empty_ ? 1 : 0;
+  records_.push_back(record);
+  ++done_;
+
+  group_empty_ = false;
+  merge_open_ = false;
+}
+
+void EditLog::AppendText(const wxChar* text, size_t len) {
+  assert(done_ > 0 && done_ == records_.size());
+  text_.insert(text_.end(), text, text + len);
+  records_.back().text_end = text_.size();
+}
+
+void EditLog::AddChar(ActionType type,
+                      size_t offset,
+                      wxChar c,
+                      bool caret_at_end) {
+  if (!MergeChar(type, offset, c, caret_at_end)) {
+    Add(type, offset, caret_at_end);
+    AppendText(&c, 1);
+  }
+  merge_open_ = true;
+}
+
+bool EditLog::MergeChar(ActionType type,
+                        size_t offset,
+                        wxChar c,
+                        bool caret_at_end) {
+  if (!merge_open_ || done_ != records_.size()) {
+    return false;
+  }
+
+  Record& last = records_.back();
+  if ((type == kInsert) != (last.is_insert != 0)
+      || caret_at_end != (last.caret_at_end != 0)) {
+    return false;
+  }
+
+  size_t start = GetTextStart(done_ - 1);
+  size_t length = last.text_end - start;
+  bool prepend = type == kDelete && caret_at_end;
+  if (prepend) {
+    if (offset + 1 != last.offset) {
+      return false;
+    }
+  } else if (offset != (type == kInsert ? last.offset + length
+                                        : last.offset)) {
+    return false;
+  }
+
+  // The char next to c in the edit.
+  wxChar next = prepend ? text_[start] : text_[last.text_end - 1];
+  if (!IsSpace(c) && IsSpace(next)) {
+    return false;
+  }
+
+  if (prepend) {
+    text_.insert(text_.begin() + start, c);
+    last.offset = offset;
+  } else {
+    text_.push_back(c);
+  }
+  ++last.text_end;
+  return true;
+}
+
+void EditLog::BeginGroup() {
+  if (group_depth_++ == 0) {
+    group_empty_ = true;
+    merge_open_ = false;
+  }
+}
+
+void EditLog::EndGroup() {
+  assert(group_depth_ > 0);
+  if (--group_depth_ == 0) {
+    merge_open_ = false;
+  }
+}
+
+void EditLog::Clear() {
+  std::vector<Record>().swap(records_);
+  std::vector<wxChar>().swap(text_);
+  done_ = 0;
+  merge_open_ = false;
+  group_empty_ = group_depth_ > 0;
+}
+
+EditLog::Edit EditLog::GetEdit(size_t index) const {
+  const Record& record = records_[index];
+  size_t text_start = GetTextStart(index);
+
+  Edit edit;
+  edit.type = record.is_insert ? kInsert : kDelete;
+  edit.offset = record.offset;
+  edit.text = text_.data() + text_start;
+  edit.length = record.text_end - text_start;
+  edit.caret_at_end = record.caret_at_end != 0;
+  return edit;
+}
+
+}  // namespace csi_training
@@ -0,0 +1,118 @@
+#ifndef NOTEPAD_NOTEPAD_EDIT_LOG_H_
+#define NOTEPAD_NOTEPAD_EDIT_LOG_H_
+
+#include <vector>
+
+#include "wx/defs.h"
+
+#include "notepad/defs.h"
+
+namespace csi_training {
+
+// The undo/redo history, a flat log of the inserts and deletes done to the
+// text. Each edit is a 16 byte record and the texts of all the edits are
+// packed one after another in a single char buffer. Both only grow, so once
+// they are big enough recording, undoing and redoing edits never allocates,
+// and dropping the edits that could be redone is O(1).
+//
+// Edits are undone and redone in groups. Every edit is a group of its own
+// unless it is recorded between BeginGroup() and EndGroup(), and chars typed
+// or deleted one after another are merged into word sized edits.
+class EditLog {
+  wxDECLARE_NO_COPY_CLASS(EditLog);
+
+ public:
+  // An edit as recorded. text is valid until the log is changed.
+  struct Edit {
+    ActionType type;
+    // Where the text was inserted or deleted.
+    size_t offset;
+    const wxChar* text;
+    size_t length;
+    // Whether the caret was after the deleted text, as for backspace.
+    bool caret_at_end;
+  };
+
+  EditLog();
+
+  // Records an edit at offset, dropping the edits that could be redone.
+  // Its text is appended with AppendText() afterwards.
+  void Add(ActionType type, size_t offset, bool caret_at_end = false);
+  void AppendText(const wxChar* text, size_t len);
+
+  // Records a single typed or deleted char. It is merged into the last edit
+  // if that one was recorded by AddChar() too and c continues it: typed
+  // right after it, or deleted right before it with backspace or at the
+  // same offset with delete. A word char next to a space of the last edit
+  // starts a new edit, so each edit holds about one word and its spaces.
+  void AddChar(ActionType type, size_t offset, wxChar c, bool caret_at_end);
+
+  // The edits recorded until the matching EndGroup() are undone and redone
+  // together. Groups may be nested, the outermost one counts.
+  void BeginGroup();
+  void EndGroup();
+
+  bool CanUndo() const { return done_ > 0; }
+  bool CanRedo() const { return done_ < records_.size(); }
+
+  // Steps back over the last group of edits done and calls
+  // revert(const Edit&) for each of them, the last one first.
+  template <typename Func>
+  void Undo(Func revert) {
+    assert(CanUndo());
+    merge_open_ = false;
+    do {
+      revert(GetEdit(--done_));
+    } while (done_ > 0 && !records_[done_].starts_group);
+  }
+
+  // Steps forward over the next group of edits undone and calls
+  // apply(const Edit&) for each of them, in the order they were done.
+  template <typename Func>
+  void Redo(Func apply) {
+    assert(CanRedo());
+    merge_open_ = false;
+    do {
+      apply(GetEdit(done_++));
+    } while (done_ < records_.size() && !records_[done_].starts_group);
+  }
+
+  // Drops all the edits and frees the memory.
+  void Clear();
+
+ private:
+  struct Record {
+    // End of the text in text_, it starts at the end of the previous one.
+    size_t text_end;
+    size_t offset : sizeof(size_t) * 8 - 3;
+    size_t is_insert : 1;
+    size_t caret_at_end : 1;
+    // Set on the first edit of every group.
+    size_t starts_group : 1;
+  };
+
+  size_t GetTextStart(size_t index) const {
+    return index > 0 ? records_[index - 1].text_end : 0;
+  }
+  Edit GetEdit(size_t index) const;
+
+  // Merges c into the last edit if it continues it, see AddChar().
+  bool MergeChar(ActionType type, size_t offset, wxChar c, bool caret_at_end);
+
+ private:
+  std::vector<Record> records_;
+  std::vector<wxChar> text_;
+  // Count of the records done, the others have been undone.
+  size_t done_;
+
+  int group_depth_;
+  // Whether no edit was recorded yet in the current group.
+  bool group_empty_;
+  // Whether the last edit was recorded by AddChar() and chars may still be
+  // merged into it.
+  bool merge_open_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_EDIT_LOG_H_
@@ -0,0 +1,98 @@
+#include "notepad/file_loader.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "notepad/defs.h"
+
+namespace csi_training {
+
+// The first batch only has to fill a screen.
+static const size_t kFirstBatchSize = 256 * 1024;
+static const size_t kBatchSize = 32 * 1024 * 1024;
+
+FileLoader::FileLoader(wxEvtHandler* handler,
+                       TaskScheduler* scheduler,
+                       const char* data,
+                       size_t size,
+                       int load_id)
+    : handler_(handler)
+    , scheduler_(scheduler)
+    , data_(data)
+    , size_(size)
+    , load_id_(load_id)
+    , first_batch_end_(0) {
+}
+
+void FileLoader::Start() {
+  // Only the first batch fills the screen, the rest of the file is indexed
+  // after the work on what is shown.
+  first_batch_end_ = GetBatchEnd(0, kFirstBatchSize);
+  first_task_ = scheduler_->Submit(
+      "load file",
+      kTaskPriorityViewport,
+      [this](const Task& task) {
+        IndexBatch(task, 0, first_batch_end_, kTaskPriorityViewport);
+      });
+  task_ = scheduler_->Submit("load file",
+                             kTaskPriorityBackground,
+                             [this](const Task& task) { Run(task); });
+}
+
+void FileLoader::Run(const Task& task) {
+  // The batches are posted in order.
+  first_task_->Wait();
+  size_t start = first_batch_end_;
+  while (start < size_ && !task.IsCancelled()) {
+    size_t end = GetBatchEnd(start, kBatchSize);
+    if (!IndexBatch(task, start, end, kTaskPriorityBackground)) {
+      break;
+    }
+    start = end;
+  }
+
+  wxThreadEvent* event = new wxThreadEvent(wxEVT_THREAD, ID_Loader_Done);
+  event->SetInt(load_id_);
+  wxQueueEvent(handler_, event);
+}
+
+bool FileLoader::IndexBatch(const Task& task,
+                            size_t start,
+                            size_t end,
+                            TaskPriority priority) {
+  if (start == end) {
+    return !task.IsCancelled();
+  }
+  std::shared_ptr<LoadedLines> loaded(new LoadedLines);
+  IndexLines(data_ + start, end - start, &loaded->lines, kBestScanner, 0,
+             scheduler_, priority);
+  loaded->size = end - start;
+
+  if (task.IsCancelled()) {
+    return false;
+  }
+  wxThreadEvent* event = new wxThreadEvent(wxEVT_THREAD, ID_Loader_Lines);
+  event->SetInt(load_id_);
+  event->SetPayload(loaded);
+  wxQueueEvent(handler_, event);
+  return true;
+}
+
+size_t FileLoader::GetBatchEnd(size_t start, size_t batch_size) const {
+  size_t end = std::min(size_, start + batch_size);
+  if (end == size_) {
+    return end;
+  }
+
+  // Cut after the last LF in the batch, or after the first one following it
+  // if the batch is inside a single long line.
+  for (size_t i = end; i > start; --i) {
+    if (data_[i - 1] == LF) {
+      return i;
+    }
+  }
+  const void* lf = memchr(data_ + end, LF, size_ - end);
+  return lf != nullptr ? static_cast<const char*>(lf) - data_ + 1 : size_;
+}
+
+}  // namespace csi_training
@@ -0,0 +1,87 @@
+#ifndef NOTEPAD_NOTEPAD_FILE_LOADER_H_
+#define NOTEPAD_NOTEPAD_FILE_LOADER_H_
+
+#include <memory>
+
+#include "wx/event.h"
+
+#include "notepad/line_indexer.h"
+#include "notepad/task_scheduler.h"
+
+namespace csi_training {
+
+// Ids of the wxEVT_THREAD events a FileLoader posts.
+enum {
+  ID_Loader_Lines = wxID_HIGHEST + 1,
+  ID_Loader_Done
+};
+
+// Lines indexed by a FileLoader, the payload of its ID_Loader_Lines events.
+struct LoadedLines {
+  // Offsets relative to the first byte of the batch.
+  LineIndex lines;
+  // Bytes in the batch, it always ends after a LF or at the end of the text.
+  size_t size;
+};
+
+// Indexes the lines of mapped UTF-8 text in tasks of the scheduler, the
+// batches are split into chunks indexed by other tasks. The lines are
+// posted to the handler in batches, each as an ID_Loader_Lines event with a
+// std::shared_ptr<LoadedLines> payload. The first batch is small so the
+// first screen can be painted right away, only it is indexed before
+// background work. An ID_Loader_Done event follows the last batch. The
+// events carry the load id in their int.
+class FileLoader {
+  wxDECLARE_NO_COPY_CLASS(FileLoader);
+
+ public:
+  FileLoader(wxEvtHandler* handler,
+             TaskScheduler* scheduler,
+             const char* data,
+             size_t size,
+             int load_id);
+
+  // Queues the tasks: one for the first batch, which the user waits for,
+  // and one for the other batches.
+  void Start();
+
+  // Asks the tasks to stop after the current batch, no more batches are
+  // posted then, nor an ID_Loader_Done event if they haven't started.
+  // Wait() for them afterwards.
+  void Cancel() {
+    first_task_->Cancel();
+    task_->Cancel();
+  }
+  void Wait() {
+    first_task_->Wait();
+    task_->Wait();
+  }
+
+ protected:
+  // Indexes the batches after the first one, once it is posted.
+  void Run(const Task& task);
+
+  // Indexes the bytes [start, end) in chunks of the priority and posts
+  // them, unless the task is cancelled. Returns false if it is.
+  bool IndexBatch(const Task& task,
+                  size_t start,
+                  size_t end,
+                  TaskPriority priority);
+
+  // Gets the end of the batch starting at start, right after a LF.
+  size_t GetBatchEnd(size_t start, size_t batch_size) const;
+
+ private:
+  wxEvtHandler* handler_;
+  TaskScheduler* scheduler_;
+  const char* data_;
+  size_t size_;
+  int load_id_;
+  size_t first_batch_end_;
+  std::shared_ptr<Task> first_task_;
+  std::shared_ptr<Task> task_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_FILE_LOADER_H_
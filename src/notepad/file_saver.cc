@@ -0,0 +1,234 @@
+#include "notepad/file_saver.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "wx/file.h"
+#include "wx/filefn.h"
+#include "wx/filename.h"
+
+#include "notepad/async_io.h"
+#include "notepad/utf8.h"
+
+#ifdef __UNIX__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace csi_training {
+
+// The encoded text is written in blocks of this many bytes, a few at a time
+// so the device is kept busy while the next ones are encoded.
+static const size_t kWriteSize = 1024 * 1024;
+static const size_t kWritesInFlight = 4;
+// Chars encoded at a time, at most 4 bytes each.
+static const size_t kEncodeChars = 64 * 1024;
+
+static const char kUtf8Bom[] = { '\xEF', '\xBB', '\xBF' };
+
+#ifdef __UNIX__
+// The mask of new files. umask() can only be read by setting it, so it is
+// read at startup, before other threads could create files.
+static const mode_t kUmask = []() {
+  mode_t mask = umask(0);
+  umask(mask);
+  return mask;
+}();
+#endif
+
+// Gives the temp file the permissions of the file it replaces, or those of a
+// new file. Temp files are only readable by their owner.
+static void CopyPermissions(const wxString& file_path, wxFile* file) {
+#ifdef __UNIX__
+  struct stat st;
+  mode_t mode = 0666 & ~kUmask;
+  if (stat(file_path.fn_str(), &st) == 0) {
+    mode = st.st_mode & 07777;
+  }
+  fchmod(file->fd(), mode);
+#endif
+}
+
+// Makes the rename of the file durable.
+static void SyncDirectory(const wxString& file_path) {
+#ifdef __UNIX__
+  wxString dir = wxFileName(file_path).GetPath();
+  if (dir.empty()) {
+    dir = wxT(".");
+  }
+  int fd = open(dir.fn_str(), O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+#endif
+}
+
+// Writes the bytes of the text, a block at a time.
+class BlockWriter {
+ public:
+  BlockWriter(wxFile* file,
+              TaskScheduler* scheduler,
+              const std::function<void(size_t)>& progress)
+      : io_(file, scheduler, kWritesInFlight, kWriteSize)
+      , progress_(progress)
+      , block_(io_.GetBuffer())
+      , block_size_(0)
+      , offset_(0)
+      , chars_(0)
+      , failed_(false) {
+  }
+
+  // Appends the bytes, which end after chars chars of the text.
+  void Append(const std::string& bytes, size_t chars) {
+    const char* data = bytes.data();
+    size_t len = bytes.size();
+    while (len > 0) {
+      size_t n = std::min(len, io_.buffer_size() - block_size_);
+      memcpy(block_ + block_size_, data, n);
+      block_size_ += n;
+      data += n;
+      len -= n;
+      if (block_size_ == io_.buffer_size()) {
+        WriteBlock(len == 0 ? chars : chars_);
+        block_ = io_.GetBuffer();
+      }
+    }
+    chars_ = chars;
+  }
+
+  // Writes what is left and waits for all the blocks, returns false if any
+  // could not be written.
+  bool Finish(size_t chars) {
+    if (block_size_ > 0) {
+      WriteBlock(chars);
+    } else {
+      io_.ReleaseBuffer(block_);
+    }
+    io_.WaitAll();
+    return !failed_;
+  }
+
+  bool failed() const { return failed_; }
+
+ private:
+  // Writes the block, at least chars chars are written once it is.
+  void WriteBlock(size_t chars) {
+    size_t size = block_size_;
+    io_.Write(block_, size, offset_, [this, size, chars](int64_t result) {
+      if (result != static_cast<int64_t>(size)) {
+        failed_ = true;
+      } else if (chars > 0 && progress_) {
+        progress_(chars);
+      }
+    });
+    offset_ += size;
+    block_size_ = 0;
+  }
+
+  AsyncIo io_;
+  std::function<void(size_t)> progress_;
+  char* block_;
+  size_t block_size_;
+  uint64_t offset_;
+  // The chars of the bytes appended so far.
+  size_t chars_;
+  bool failed_;
+};
+
+bool SaveSnapshot(const PieceTable::Snapshot& snapshot,
+                  const wxString& file_path,
+                  const std::function<void(size_t)>& progress,
+                  TaskScheduler* scheduler) {
+  wxFile file;
+  wxString temp_path = wxFileName::CreateTempFileName(file_path, &file);
+  if (temp_path.empty()) {
+    return false;
+  }
+  CopyPermissions(file_path, &file);
+
+  bool written = false;
+  {
+    BlockWriter writer(&file, scheduler, progress);
+    std::string bytes;
+    bytes.reserve(4 * kEncodeChars);
+    // The text keeps the BOM it was loaded with.
+    const MappedText* original = snapshot.GetMappedOriginal();
+    if (original != nullptr && original->has_bom()) {
+      bytes.assign(kUtf8Bom, sizeof(kUtf8Bom));
+      writer.Append(bytes, 0);
+    }
+    size_t done = 0;
+    snapshot.ForEachRun(
+        [&](const wxChar* data, size_t len) {
+          while (!writer.failed() && len > 0) {
+            size_t n = std::min(len, kEncodeChars);
+            bytes.clear();
+            Utf8Encode(data, n, &bytes);
+            data += n;
+            len -= n;
+            done += n;
+            writer.Append(bytes, done);
+          }
+        });
+    written = writer.Finish(done);
+  }
+
+  // Flush() syncs the file to disk, the rename must not reach the disk
+  // before the text does.
+  if (written && file.Flush() && file.Close()
+      && wxRenameFile(temp_path, file_path, true)) {
+    SyncDirectory(file_path);
+    return true;
+  }
+
+  file.Close();
+  wxRemoveFile(temp_path);
+  return false;
+}
+
+FileSaver::FileSaver(wxEvtHandler* handler,
+                     std::shared_ptr<const PieceTable::Snapshot> snapshot,
+                     const wxString& file_path,
+                     ProgressFunc progress,
+                     DoneFunc done)
+    : handler_(handler)
+    , snapshot_(std::move(snapshot))
+    , file_path_(file_path.Clone())
+    , progress_(std::move(progress))
+    , done_(std::move(done))
+    , scheduler_(nullptr) {
+}
+
+void FileSaver::Start(TaskScheduler* scheduler) {
+  scheduler_ = scheduler;
+  task_ = scheduler->Submit("save file",
+                            kTaskPriorityBackground,
+                            [this](const Task& task) { Run(task); });
+}
+
+void FileSaver::Run(const Task& task) {
+  size_t length = snapshot_->GetLength();
+  int percent = 0;
+  bool saved = SaveSnapshot(
+      *snapshot_,
+      file_path_,
+      [this, &task, length, &percent](size_t done) {
+        int new_percent = static_cast<int>(done * 100 / length);
+        if (new_percent != percent) {
+          percent = new_percent;
+          ProgressFunc progress = progress_;
+          task.CallAfter(handler_, [progress, new_percent]() {
+            progress(new_percent);
+          });
+        }
+      },
+      scheduler_);
+
+  DoneFunc done = done_;
+  task.CallAfter(handler_, [done, saved]() { done(saved); });
+}
+
+}  // namespace csi_training
@@ -0,0 +1,67 @@
+#ifndef NOTEPAD_NOTEPAD_FILE_SAVER_H_
+#define NOTEPAD_NOTEPAD_FILE_SAVER_H_
+
+#include <functional>
+#include <memory>
+
+#include "wx/event.h"
+#include "wx/string.h"
+
+#include "notepad/piece_table.h"
+#include "notepad/task_scheduler.h"
+
+namespace csi_training {
+
+// Writes the snapshot as UTF-8 to a temp file beside file_path, flushes it
+// to disk and renames it over file_path, so the file holds either the old or
+// the new text whenever the editor or the system stops. The file keeps its
+// permissions, and its BOM if the original text had one. progress, if set,
+// is called with the count of chars written so far. Returns false if the
+// file could not be saved, it is left intact then. The text is encoded
+// while the blocks before it are written, through an AsyncIo whose fallback
+// runs on the scheduler, if any.
+bool SaveSnapshot(const PieceTable::Snapshot& snapshot,
+                  const wxString& file_path,
+                  const std::function<void(size_t)>& progress = nullptr,
+                  TaskScheduler* scheduler = nullptr);
+
+// Saves a snapshot of the text in a task of the scheduler, so the text can
+// be edited meanwhile. progress is called with the percentage written, then
+// done with whether the file was saved, both on the UI thread through the
+// handler. Wait() for the task after the latter.
+class FileSaver {
+  wxDECLARE_NO_COPY_CLASS(FileSaver);
+
+ public:
+  typedef std::function<void(int percent)> ProgressFunc;
+  typedef std::function<void(bool saved)> DoneFunc;
+
+  FileSaver(wxEvtHandler* handler,
+            std::shared_ptr<const PieceTable::Snapshot> snapshot,
+            const wxString& file_path,
+            ProgressFunc progress,
+            DoneFunc done);
+
+  // Queues the task, it runs after the work on what is shown. Its writes
+  // run on the scheduler too without io_uring.
+  void Start(TaskScheduler* scheduler);
+  void Wait() { task_->Wait(); }
+
+  const wxString& file_path() const { return file_path_; }
+
+ protected:
+  void Run(const Task& task);
+
+ private:
+  wxEvtHandler* handler_;
+  std::shared_ptr<const PieceTable::Snapshot> snapshot_;
+  wxString file_path_;
+  ProgressFunc progress_;
+  DoneFunc done_;
+  TaskScheduler* scheduler_;
+  std::shared_ptr<Task> task_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_FILE_SAVER_H_
@@ -0,0 +1,356 @@
+#include "notepad/highlighter.h"
+
+#include <algorithm>
+
+#include "notepad/defs.h"
+
+namespace csi_training {
+
+// Rows lexed on the UI thread at once, a few screens.
+static const int kMaxRowsLexedAtOnce = 4096;
+// Rows in a batch of states posted by the worker.
+static const size_t kBatchRows = 64 * 1024;
+// Enough for the rows on a screen and the ones edited lately.
+static const size_t kMaxRowRuns = 256;
+
+HighlightWorker::HighlightWorker(wxEvtHandler* handler,
+                                 std::shared_ptr<const TextSnapshot> snapshot,
+                                 std::shared_ptr<const Lexer> lexer,
+                                 size_t offset,
+                                 int row,
+                                 int state,
+                                 int worker_id)
+    : handler_(handler)
+    , snapshot_(snapshot)
+    , lexer_(lexer)
+    , offset_(offset)
+    , row_(row)
+    , state_(state)
+    , worker_id_(worker_id) {
+}
+
+void HighlightWorker::Start(TaskScheduler* scheduler) {
+  task_ = scheduler->Submit("highlight",
+                            kTaskPriorityBackground,
+                            [this](const Task& task) { Run(task); });
+}
+
+void HighlightWorker::Run(const Task& task) {
+  std::shared_ptr<LexedStates> lexed(new LexedStates);
+  lexed->first_row = row_ + 1;
+  std::wstring line;
+  std::vector<TokenRun> runs;
+  int state = state_;
+
+  // The rows are split at their LFs. The last row has no row after it, so
+  // it isn't lexed.
+  snapshot_->ForEachRunFrom(offset_, [&](const wxChar* data, size_t len) {
+    size_t start = 0;
+    for (size_t i = 0; i < len; ++i) {
+      if (data[i] != LF) {
+        continue;
+      }
+      AppendLine(&line, data + start, i - start);
+      start = i + 1;
+
+      size_t display_len = line.size();
+      if (display_len > 0 && line[display_len - 1] == CR) {
+        --display_len;
+      }
+      runs.clear();
+      if (display_len > Highlighter::kMaxLexedRowLength) {
+        state = Lexer::kInitialState;
+      } else {
+        state = lexer_->LexRow(line.data(), display_len, state, &runs);
+      }
+      line.clear();
+      lexed->states.push_back(state);
+
+      if (task.IsCancelled()) {
+        return false;
+      }
+      if (lexed->states.size() == kBatchRows) {
+        int next_row = lexed->first_row + static_cast<int>(kBatchRows);
+        PostStates(lexed);
+        lexed.reset(new LexedStates);
+        lexed->first_row = next_row;
+      }
+    }
+    AppendLine(&line, data + start, len - start);
+    return !task.IsCancelled();
+  });
+
+  if (!task.IsCancelled() && !lexed->states.empty()) {
+    PostStates(lexed);
+  }
+}
+
+void HighlightWorker::AppendLine(std::wstring* line,
+                                 const wxChar* data,
+                                 size_t len) {
+  // Rows too long to lex are only kept as far as needed to tell them, with
+  // a char more and a CR.
+  size_t max_len = Highlighter::kMaxLexedRowLength + 2;
+  if (line->size() < max_len) {
+    line->append(data, std::min(len, max_len - line->size()));
+  }
+}
+
+void HighlightWorker::PostStates(std::shared_ptr<LexedStates> lexed) {
+  wxThreadEvent* event = new wxThreadEvent(wxEVT_THREAD,
+                                           ID_Highlighter_States);
+  event->SetInt(worker_id_);
+  event->SetPayload(lexed);
+  wxQueueEvent(handler_, event);
+}
+
+/////////////////////////////////////////
+
+Highlighter::Highlighter(wxEvtHandler* handler, TaskScheduler* scheduler)
+    : handler_(handler)
+    , scheduler_(scheduler)
+    , known_rows_(0)
+    , tentative_rows_(0)
+    , dirty_rows_(0)
+    , changed_first_row_(-1)
+    , changed_last_row_(-1)
+    , worker_(nullptr)
+    , worker_id_(0)
+    , worker_current_(false)
+    , worker_next_row_(0) {
+}
+
+Highlighter::~Highlighter() {
+  StopWorker();
+}
+
+void Highlighter::SetLexer(std::shared_ptr<const Lexer> lexer,
+                           const TextBuffer& buffer) {
+  StopWorker();
+  lexer_ = lexer;
+  row_runs_.clear();
+  rows_.clear();
+  states_.Clear();
+  if (lexer_) {
+    states_.Assign(buffer.GetRowCount(), Lexer::kInitialState);
+  }
+  // The first row starts in the initial state.
+  known_rows_ = 1;
+  tentative_rows_ = 1;
+  dirty_rows_ = 0;
+  AddChangedStates(0, TextBuffer::kAllRowsAfter);
+}
+
+void Highlighter::ApplyRowEdits(
+    const std::vector<TextBuffer::RowEdit>& edits) {
+  if (!lexer_ || edits.empty()) {
+    return;
+  }
+
+  for (const TextBuffer::RowEdit& edit : edits) {
+    int row = edit.row;
+    int end = row + edit.new_count;
+    int moved = edit.new_count - edit.old_count;
+
+    // The row keeps its start state, the rows replaced after it are new.
+    states_.Replace(row + 1, edit.old_count - 1, edit.new_count - 1,
+                    Lexer::kInitialState);
+
+    known_rows_ = std::min(known_rows_, row + 1);
+    if (tentative_rows_ >= row + edit.old_count) {
+      tentative_rows_ += moved;
+    } else {
+      tentative_rows_ = std::min(tentative_rows_, row + 1);
+    }
+    dirty_rows_ = std::max(dirty_rows_ > row ? dirty_rows_ + moved : 0, end);
+  }
+
+  // The worker lexes rows that are gone, its states are ignored.
+  ++worker_id_;
+  worker_current_ = false;
+  if (worker_ != nullptr) {
+    worker_->Cancel();
+  }
+}
+
+bool Highlighter::LexRows(const TextBuffer& buffer, int last_row) {
+  if (!lexer_) {
+    return true;
+  }
+  last_row = std::min(last_row, states_.size() - 1);
+
+  std::vector<TokenRun> runs;
+  for (int count = 0; known_rows_ <= last_row; ++count) {
+    if (count == kMaxRowsLexedAtOnce) {
+      // The rows left are drawn plain for now, and again once lexed.
+      AddChangedStates(known_rows_, last_row);
+      return false;
+    }
+    int row = known_rows_ - 1;
+    size_t len = static_cast<size_t>(buffer.GetRowDisplayCharCount(row));
+    if (len > kMaxLexedRowLength) {
+      SetNextState(Lexer::kInitialState);
+      continue;
+    }
+    TextView line = buffer.GetRowDisplayView(row);
+    runs.clear();
+    SetNextState(lexer_->LexRow(line.data(), line.size(), states_[row],
+                                &runs));
+  }
+  return true;
+}
+
+void Highlighter::LexInBackground(const TextBuffer& buffer) {
+  if (!lexer_ || worker_current_
+      || known_rows_ >= states_.size()) {
+    return;
+  }
+  std::shared_ptr<const TextSnapshot> snapshot = buffer.TakeSnapshot();
+  if (!snapshot) {
+    // Loading, the rows are lexed once it is loaded.
+    return;
+  }
+
+  StopWorker();
+  int row = known_rows_ - 1;
+  worker_ = new HighlightWorker(handler_,
+                                snapshot,
+                                lexer_,
+                                buffer.GetOffset(wxPoint(0, row)),
+                                row,
+                                states_[row],
+                                worker_id_);
+  worker_->Start(scheduler_);
+  worker_current_ = true;
+  worker_next_row_ = known_rows_;
+}
+
+void Highlighter::OnLexedStates(const wxThreadEvent& evt,
+                                const TextBuffer& buffer) {
+  if (evt.GetInt() != worker_id_ || !lexer_) {
+    return;
+  }
+
+  std::shared_ptr<LexedStates> lexed =
+      evt.GetPayload<std::shared_ptr<LexedStates> >();
+  worker_next_row_ = lexed->first_row + static_cast<int>(lexed->states.size());
+  for (size_t i = 0; i < lexed->states.size(); ++i) {
+    int row = lexed->first_row + static_cast<int>(i);
+    // The rows lexed here meanwhile, or known again as lexing converged.
+    if (row < known_rows_) {
+      continue;
+    }
+    if (row > known_rows_) {
+      break;
+    }
+    SetNextState(lexed->states[i]);
+  }
+
+  if (known_rows_ >= states_.size() && worker_ != nullptr) {
+    worker_->Cancel();
+  }
+  LexInBackground(buffer);
+}
+
+void Highlighter::StopWorker() {
+  if (worker_ != nullptr) {
+    worker_->Cancel();
+    worker_->Wait();
+    delete worker_;
+    worker_ = nullptr;
+  }
+  // Ignore the states the stopped worker has already posted.
+  ++worker_id_;
+  worker_current_ = false;
+}
+
+bool Highlighter::GetRowState(int row, int* state) const {
+  if (!lexer_ || row < 0 || row >= known_rows_) {
+    return false;
+  }
+  *state = states_[row];
+  return true;
+}
+
+const std::vector<TokenRun>& Highlighter::GetRuns(int row,
+                                                  size_t version,
+                                                  int state,
+                                                  TextView line) {
+  std::unordered_map<int, RowRunsList::iterator>::iterator found =
+      rows_.find(row);
+  if (found != rows_.end()) {
+    row_runs_.splice(row_runs_.begin(), row_runs_, found->second);
+    RowRuns& cached = row_runs_.front();
+    if (cached.version == version && cached.state == state) {
+      return cached.runs;
+    }
+  } else if (row_runs_.size() < kMaxRowRuns) {
+    row_runs_.push_front(RowRuns());
+  } else {
+    // Reuse the runs of the row used least.
+    rows_.erase(row_runs_.back().row);
+    row_runs_.splice(row_runs_.begin(), row_runs_, --row_runs_.end());
+  }
+
+  RowRuns& row_runs = row_runs_.front();
+  row_runs.row = row;
+  row_runs.version = version;
+  row_runs.state = state;
+  row_runs.runs.clear();
+  if (line.size() > kMaxLexedRowLength) {
+    TokenRun plain = { 0, kTokenPlain };
+    row_runs.runs.push_back(plain);
+  } else {
+    lexer_->LexRow(line.data(), line.size(), state, &row_runs.runs);
+  }
+  rows_[row] = row_runs_.begin();
+  return row_runs.runs;
+}
+
+bool Highlighter::TakeChangedStates(int* first_row, int* last_row) {
+  if (changed_first_row_ < 0) {
+    return false;
+  }
+  *first_row = changed_first_row_;
+  *last_row = changed_last_row_;
+  changed_first_row_ = -1;
+  return true;
+}
+
+void Highlighter::SetNextState(int state) {
+  int row = known_rows_;
+  if (row >= dirty_rows_ && row < tentative_rows_ && states_[row] == state) {
+    // The rows from here on start as they did before the edits.
+    known_rows_ = tentative_rows_;
+    if (worker_current_ && known_rows_ > worker_next_row_) {
+      // The worker would lex them again, it goes on after them instead.
+      worker_->Cancel();
+      ++worker_id_;
+      worker_current_ = false;
+    }
+    return;
+  }
+
+  if (row >= tentative_rows_ || states_[row] != state) {
+    AddChangedStates(row, row);
+  }
+  states_[row] = state;
+  ++known_rows_;
+  tentative_rows_ = std::max(tentative_rows_, known_rows_);
+}
+
+void Highlighter::AddChangedStates(int first_row, int last_row) {
+  if (changed_first_row_ < 0) {
+    changed_first_row_ = first_row;
+    changed_last_row_ = last_row;
+    return;
+  }
+  if (last_row == TextBuffer::kAllRowsAfter
+      || (changed_last_row_ != TextBuffer::kAllRowsAfter
+          && last_row > changed_last_row_)) {
+    changed_last_row_ = last_row;
+  }
+  changed_first_row_ = std::min(changed_first_row_, first_row);
+}
+
+}  // namespace csi_training
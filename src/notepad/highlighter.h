@@ -0,0 +1,181 @@
+#ifndef NOTEPAD_NOTEPAD_HIGHLIGHTER_H_
+#define NOTEPAD_NOTEPAD_HIGHLIGHTER_H_
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "wx/event.h"
+
+#include "notepad/lexer.h"
+#include "notepad/row_states.h"
+#include "notepad/task_scheduler.h"
+#include "notepad/text_buffer.h"
+
+namespace csi_training {
+
+// Ids of the wxEVT_THREAD events a HighlightWorker posts.
+enum {
+  ID_Highlighter_States = wxID_HIGHEST + 31
+};
+
+// States lexed by a HighlightWorker, the payload of its events.
+struct LexedStates {
+  // The states rows [first_row, first_row + states.size()) start in.
+  int first_row;
+  std::vector<int> states;
+};
+
+// Lexes the rows of a snapshot from a row on, in a background task. The
+// states the rows after it start in are posted to the handler in batches,
+// each as an ID_Highlighter_States event with a
+// std::shared_ptr<LexedStates> payload and the worker id in its int.
+class HighlightWorker {
+  wxDECLARE_NO_COPY_CLASS(HighlightWorker);
+
+ public:
+  // Lexes from row, which starts at offset in state.
+  HighlightWorker(wxEvtHandler* handler,
+                  std::shared_ptr<const TextSnapshot> snapshot,
+                  std::shared_ptr<const Lexer> lexer,
+                  size_t offset,
+                  int row,
+                  int state,
+                  int worker_id);
+
+  void Start(TaskScheduler* scheduler);
+
+  // Asks the task to stop after the current row, no more batches are
+  // posted then. Wait() for it afterwards.
+  void Cancel() { task_->Cancel(); }
+  void Wait() { task_->Wait(); }
+
+ protected:
+  void Run(const Task& task);
+
+ private:
+  // Appends the chars to the row being split off, up to what is lexed.
+  static void AppendLine(std::wstring* line, const wxChar* data, size_t len);
+  void PostStates(std::shared_ptr<LexedStates> lexed);
+
+ private:
+  wxEvtHandler* handler_;
+  std::shared_ptr<const TextSnapshot> snapshot_;
+  std::shared_ptr<const Lexer> lexer_;
+  size_t offset_;
+  int row_;
+  int state_;
+  int worker_id_;
+  std::shared_ptr<Task> task_;
+};
+
+// Highlights the rows of a buffer with a lexer. The state every row starts
+// in is kept, so after an edit the rows are lexed again from the edited one
+// only until they end in the state they ended in before. The rows shown are
+// lexed on the UI thread, a HighlightWorker lexes the ones after them.
+class Highlighter {
+  wxDECLARE_NO_COPY_CLASS(Highlighter);
+
+ public:
+  // Rows longer than this aren't lexed, they are drawn plain and the rows
+  // after them start in the initial state.
+  static const size_t kMaxLexedRowLength = 64 * 1024;
+
+  // The worker runs on the scheduler, its events are posted to handler.
+  Highlighter(wxEvtHandler* handler, TaskScheduler* scheduler);
+  ~Highlighter();
+
+  // Sets the lexer for the text of the buffer, nullptr for plain text. All
+  // the rows are lexed again.
+  void SetLexer(std::shared_ptr<const Lexer> lexer, const TextBuffer& buffer);
+  bool IsEnabled() const { return lexer_ != nullptr; }
+
+  // Follows the row edits of the buffer, call it before they are forgotten.
+  void ApplyRowEdits(const std::vector<TextBuffer::RowEdit>& edits);
+
+  // Lexes the rows up to last_row on this thread, at most a few thousand of
+  // them so input is never blocked. Returns true if the states of the rows
+  // up to last_row are known.
+  bool LexRows(const TextBuffer& buffer, int last_row);
+
+  // Lexes the rows left in the background, if they aren't being lexed yet.
+  void LexInBackground(const TextBuffer& buffer);
+
+  // Takes the states lexed by the worker, from an ID_Highlighter_States
+  // event. The worker is started again if lexing converged past it.
+  void OnLexedStates(const wxThreadEvent& evt, const TextBuffer& buffer);
+
+  // Stops the worker, if any, and waits for it.
+  void StopWorker();
+
+  // Gets the state the row starts in, returns false if it isn't known yet.
+  bool GetRowState(int row, int* state) const;
+
+  // Gets the runs of the row, which starts in state and is at version. The
+  // runs of the rows used last are kept, the reference is valid until the
+  // next call.
+  const std::vector<TokenRun>& GetRuns(int row,
+                                       size_t version,
+                                       int state,
+                                       TextView line);
+
+  // Gets the rows whose start state changed since the last call, which are
+  // drawn in other colours now, and forgets them. *last_row is
+  // TextBuffer::kAllRowsAfter if they run to the end. Returns false if none
+  // changed.
+  bool TakeChangedStates(int* first_row, int* last_row);
+
+ private:
+  // Sets the state row known_rows_ starts in, the last row lexed ended in
+  // it. If that converges past the rows the worker has posted, the worker
+  // is stopped, its rows are known already.
+  void SetNextState(int state);
+
+  void AddChangedStates(int first_row, int last_row);
+
+  struct RowRuns {
+    int row;
+    size_t version;
+    int state;
+    std::vector<TokenRun> runs;
+  };
+
+  typedef std::list<RowRuns> RowRunsList;
+
+ private:
+  wxEvtHandler* handler_;
+  TaskScheduler* scheduler_;
+  std::shared_ptr<const Lexer> lexer_;
+
+  // The state each row starts in. The rows before known_rows_ are lexed.
+  // The rows in [known_rows_, tentative_rows_) hold the states they started
+  // in before the last edits, and the rows before dirty_rows_ were edited
+  // since. Lexing converges when a row at or after dirty_rows_ starts in its
+  // tentative state, the rows after it are known again then.
+  RowStates states_;
+  int known_rows_;
+  int tentative_rows_;
+  int dirty_rows_;
+
+  // The rows whose state changed, none if changed_first_row_ is -1.
+  int changed_first_row_;
+  int changed_last_row_;
+
+  HighlightWorker* worker_;
+  // Tells the events of the current worker from those of stopped ones.
+  int worker_id_;
+  // Whether the worker lexes the rows as they are now.
+  bool worker_current_;
+  // The row the current worker posts the state of next.
+  int worker_next_row_;
+
+  // The runs of the rows used last, the one used last first.
+  RowRunsList row_runs_;
+  std::unordered_map<int, RowRunsList::iterator> rows_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_HIGHLIGHTER_H_
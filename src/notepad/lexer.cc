@@ -0,0 +1,360 @@
+#include "notepad/lexer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "wx/filename.h"
+
+namespace csi_training {
+
+const int Lexer::kInitialState;
+
+// Chars are classified as ASCII, the other chars are plain text.
+static bool IsDigit(wxChar c) {
+  return c >= '0' && c <= '9';
+}
+
+static bool IsAlpha(wxChar c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool IsAlnum(wxChar c) {
+  return IsAlpha(c) || IsDigit(c);
+}
+
+static bool IsSpace(wxChar c) {
+  return c == ' ' || c == '\t';
+}
+
+static bool IsTimestampChar(wxChar c) {
+  return IsDigit(c) || (c > 0 && c < 0x80 && strchr("[]-:.,/T ", c));
+}
+
+static wxChar ToLower(wxChar c) {
+  return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// Starts a run of kind at start, unless the last run is of that kind.
+static void AddRun(int start, TokenKind kind, std::vector<TokenRun>* runs) {
+  if (runs->empty() || runs->back().kind != kind) {
+    TokenRun run = { start, kind };
+    runs->push_back(run);
+  }
+}
+
+// Finds the first occurrence of the ASCII string s in [from, len).
+static size_t Find(const wxChar* text, size_t len, size_t from,
+                   const char* s) {
+  size_t n = strlen(s);
+  for (size_t i = from; i + n <= len; ++i) {
+    if (std::equal(s, s + n, text + i)) {
+      return i;
+    }
+  }
+  return len;
+}
+
+// Compares text[0, len) to the ASCII string s, ignoring the case of text if
+// lower is set.
+static int Compare(const wxChar* text, size_t len, const char* s,
+                   bool lower = false) {
+  size_t i = 0;
+  for (; i < len && s[i] != '\0'; ++i) {
+    wxChar c = lower ? ToLower(text[i]) : text[i];
+    if (c != static_cast<wxChar>(s[i])) {
+      return c < static_cast<wxChar>(s[i]) ? -1 : 1;
+    }
+  }
+  if (i < len) {
+    return 1;
+  }
+  return s[i] == '\0' ? 0 : -1;
+}
+
+// Finds text[0, len) in the sorted words.
+static bool IsWord(const wxChar* text, size_t len, const char* const* words,
+                   size_t count, bool lower = false) {
+  const char* const* end = words + count;
+  const char* const* it = std::lower_bound(
+      words, end, text, [len, lower](const char* word, const wxChar* t) {
+        return Compare(t, len, word, lower) > 0;
+      });
+  return it != end && Compare(text, len, *it, lower) == 0;
+}
+
+/////////////////////////////////////////
+
+// C and C++. Rows end inside a block comment or a directive continued with a
+// backslash, the other states are reset at the end of the row.
+class CppLexer : public Lexer {
+ public:
+  int LexRow(const wxChar* text,
+             size_t len,
+             int state,
+             std::vector<TokenRun>* runs) const override;
+
+ private:
+  enum State {
+    kNormal = kInitialState,
+    kBlockComment,
+    kDirective
+  };
+
+  static bool IsKeyword(const wxChar* text, size_t len);
+  static bool EndsWithBackslash(const wxChar* text, size_t len);
+};
+
+bool CppLexer::IsKeyword(const wxChar* text, size_t len) {
+  static const char* const kKeywords[] = {
+    "alignas", "alignof", "auto", "bool", "break", "case", "catch", "char",
+    "char16_t", "char32_t", "char8_t", "class", "const", "const_cast",
+    "consteval", "constexpr", "constinit", "continue", "decltype",
+    "default", "delete", "do", "double", "dynamic_cast", "else", "enum",
+    "explicit", "extern", "false", "final", "float", "for", "friend",
+    "goto", "if", "inline", "int", "long", "mutable", "namespace", "new",
+    "noexcept", "nullptr", "operator", "override", "private", "protected",
+    "public", "register", "reinterpret_cast", "return", "short", "signed",
+    "sizeof", "static", "static_assert", "static_cast", "struct", "switch",
+    "template", "this", "thread_local", "throw", "true", "try", "typedef",
+    "typeid", "typename", "union", "unsigned", "using", "virtual", "void",
+    "volatile", "wchar_t", "while"
+  };
+  return IsWord(text, len, kKeywords, WXSIZEOF(kKeywords));
+}
+
+bool CppLexer::EndsWithBackslash(const wxChar* text, size_t len) {
+  while (len > 0 && IsSpace(text[len - 1])) {
+    --len;
+  }
+  return len > 0 && text[len - 1] == '\\';
+}
+
+int CppLexer::LexRow(const wxChar* text,
+                     size_t len,
+                     int state,
+                     std::vector<TokenRun>* runs) const {
+  size_t i = 0;
+  if (state == kBlockComment) {
+    AddRun(0, kTokenComment, runs);
+    size_t end = Find(text, len, 0, "*/");
+    if (end == len) {
+      return kBlockComment;
+    }
+    i = end + 2;
+  } else if (state == kDirective) {
+    AddRun(0, kTokenPreprocessor, runs);
+    return EndsWithBackslash(text, len) ? kDirective : kNormal;
+  }
+
+  size_t first = i;
+  while (first < len && IsSpace(text[first])) {
+    ++first;
+  }
+  if (first < len && text[first] == '#') {
+    // The directive runs to the end of the row or to a comment.
+    AddRun(static_cast<int>(first), kTokenPreprocessor, runs);
+    size_t comment = std::min(Find(text, len, first, "//"),
+                              Find(text, len, first, "/*"));
+    if (comment == len) {
+      return EndsWithBackslash(text, len) ? kDirective : kNormal;
+    }
+    i = comment;
+  }
+
+  while (i < len) {
+    wxChar c = text[i];
+    wxChar next = i + 1 < len ? text[i + 1] : 0;
+    size_t start = i;
+
+    if (c == '/' && next == '/') {
+      AddRun(static_cast<int>(start), kTokenComment, runs);
+      return kNormal;
+    }
+    if (c == '/' && next == '*') {
+      AddRun(static_cast<int>(start), kTokenComment, runs);
+      size_t end = Find(text, len, i + 2, "*/");
+      if (end == len) {
+        return kBlockComment;
+      }
+      i = end + 2;
+      continue;
+    }
+
+    if (c == '"' || c == '\'') {
+      // To the closing quote, or to the end of the row.
+      for (++i; i < len && text[i] != c; ++i) {
+        if (text[i] == '\\') {
+          ++i;
+        }
+      }
+      i = std::min(i + 1, len);
+      AddRun(static_cast<int>(start), kTokenString, runs);
+      continue;
+    }
+
+    if (IsDigit(c) || (c == '.' && IsDigit(next))) {
+      while (i < len && (IsAlnum(text[i]) || text[i] == '.'
+                         || text[i] == '\'')) {
+        ++i;
+      }
+      AddRun(static_cast<int>(start), kTokenNumber, runs);
+      continue;
+    }
+
+    if (IsAlpha(c)) {
+      while (i < len && IsAlnum(text[i])) {
+        ++i;
+      }
+      bool keyword = IsKeyword(text + start, i - start);
+      AddRun(static_cast<int>(start), keyword ? kTokenKeyword : kTokenPlain,
+             runs);
+      continue;
+    }
+
+    AddRun(static_cast<int>(start), kTokenPlain, runs);
+    ++i;
+  }
+  return kNormal;
+}
+
+/////////////////////////////////////////
+
+// INI style config files: comments, [sections] and key = value rows. Rows
+// are lexed on their own.
+class ConfigLexer : public Lexer {
+ public:
+  int LexRow(const wxChar* text,
+             size_t len,
+             int state,
+             std::vector<TokenRun>* runs) const override;
+};
+
+int ConfigLexer::LexRow(const wxChar* text,
+                        size_t len,
+                        int state,
+                        std::vector<TokenRun>* runs) const {
+  size_t i = 0;
+  while (i < len && IsSpace(text[i])) {
+    ++i;
+  }
+  AddRun(0, kTokenPlain, runs);
+  if (i == len) {
+    return kInitialState;
+  }
+
+  if (text[i] == '#' || text[i] == ';') {
+    AddRun(static_cast<int>(i), kTokenComment, runs);
+    return kInitialState;
+  }
+  if (text[i] == '[') {
+    AddRun(static_cast<int>(i), kTokenSection, runs);
+    return kInitialState;
+  }
+
+  size_t separator = i;
+  while (separator < len && text[separator] != '='
+         && text[separator] != ':') {
+    ++separator;
+  }
+  if (separator == len) {
+    return kInitialState;
+  }
+  AddRun(static_cast<int>(i), kTokenKey, runs);
+  AddRun(static_cast<int>(separator), kTokenPlain, runs);
+
+  size_t value = separator + 1;
+  while (value < len && IsSpace(text[value])) {
+    ++value;
+  }
+  if (value < len && (text[value] == '"' || text[value] == '\'')) {
+    AddRun(static_cast<int>(value), kTokenString, runs);
+  } else if (value < len && (IsDigit(text[value]) || text[value] == '-')) {
+    AddRun(static_cast<int>(value), kTokenNumber, runs);
+  }
+  return kInitialState;
+}
+
+/////////////////////////////////////////
+
+// Logs: the timestamp a row starts with, and the rows of errors and warnings.
+// Rows are lexed on their own.
+class LogLexer : public Lexer {
+ public:
+  int LexRow(const wxChar* text,
+             size_t len,
+             int state,
+             std::vector<TokenRun>* runs) const override;
+};
+
+int LogLexer::LexRow(const wxChar* text,
+                     size_t len,
+                     int state,
+                     std::vector<TokenRun>* runs) const {
+  static const char* const kErrorWords[] = {
+    "critical", "error", "exception", "fatal", "severe"
+  };
+  static const char* const kWarningWords[] = {
+    "warn", "warning"
+  };
+
+  size_t i = 0;
+  if (len > 0 && (IsDigit(text[0]) || text[0] == '[')) {
+    while (i < len && IsTimestampChar(text[i])) {
+      ++i;
+    }
+    AddRun(0, kTokenNumber, runs);
+  }
+  AddRun(static_cast<int>(i), kTokenPlain, runs);
+
+  // The row takes the kind of its first level word.
+  for (size_t start = i; start < len;) {
+    if (!IsAlpha(text[start])) {
+      ++start;
+      continue;
+    }
+    size_t end = start;
+    while (end < len && IsAlnum(text[end])) {
+      ++end;
+    }
+    if (IsWord(text + start, end - start, kErrorWords,
+               WXSIZEOF(kErrorWords), true)) {
+      AddRun(static_cast<int>(i), kTokenError, runs);
+      break;
+    }
+    if (IsWord(text + start, end - start, kWarningWords,
+               WXSIZEOF(kWarningWords), true)) {
+      AddRun(static_cast<int>(i), kTokenWarning, runs);
+      break;
+    }
+    start = end;
+  }
+  return kInitialState;
+}
+
+/////////////////////////////////////////
+
+std::shared_ptr<const Lexer> CreateLexer(const wxString& file_path) {
+  static const char* const kCppExtensions[] = {
+    "c", "cc", "cpp", "cxx", "h", "hh", "hpp", "hxx", "inl", "ipp"
+  };
+  static const char* const kConfigExtensions[] = {
+    "cfg", "conf", "ini", "properties", "toml"
+  };
+
+  wxString ext = wxFileName(file_path).GetExt();
+  const wxChar* text = ext.wc_str();
+  if (IsWord(text, ext.length(), kCppExtensions,
+             WXSIZEOF(kCppExtensions), true)) {
+    return std::make_shared<CppLexer>();
+  }
+  if (IsWord(text, ext.length(), kConfigExtensions,
+             WXSIZEOF(kConfigExtensions), true)) {
+    return std::make_shared<ConfigLexer>();
+  }
+  if (Compare(text, ext.length(), "log", true) == 0) {
+    return std::make_shared<LogLexer>();
+  }
+  return nullptr;
+}
+
+}  // namespace csi_training
@@ -0,0 +1,57 @@
+#ifndef NOTEPAD_NOTEPAD_LEXER_H_
+#define NOTEPAD_NOTEPAD_LEXER_H_
+
+#include <memory>
+#include <vector>
+
+#include "wx/defs.h"
+#include "wx/string.h"
+
+namespace csi_training {
+
+enum TokenKind {
+  kTokenPlain = 0,
+  kTokenComment,
+  kTokenString,
+  kTokenNumber,
+  kTokenKeyword,
+  kTokenPreprocessor,
+  kTokenSection,
+  kTokenKey,
+  kTokenError,
+  kTokenWarning,
+  kTokenKindCount
+};
+
+// The chars of a row from column start on, up to the start of the next run,
+// are of the same kind.
+struct TokenRun {
+  int start;
+  TokenKind kind;
+};
+
+// Splits rows into token runs. A row is lexed from the state the row before
+// ended in, so rows can be lexed again from any row whose start state is
+// known. A lexer keeps no state of its own and can be used from any thread.
+class Lexer {
+ public:
+  // The state the first row starts in.
+  static const int kInitialState = 0;
+
+  virtual ~Lexer() {}
+
+  // Lexes the row, without its line break, from state. Appends the runs of
+  // the row to runs and returns the state the next row starts in.
+  virtual int LexRow(const wxChar* text,
+                     size_t len,
+                     int state,
+                     std::vector<TokenRun>* runs) const = 0;
+};
+
+// Gets the lexer for the file from its name: C/C++ sources, config files or
+// logs. Returns nullptr for plain text.
+std::shared_ptr<const Lexer> CreateLexer(const wxString& file_path);
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_LEXER_H_
@@ -0,0 +1,316 @@
+#include "notepad/line_indexer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#include "notepad/defs.h"
+#include "notepad/task_scheduler.h"
+#include "notepad/utf8.h"
+
+#if defined(__x86_64__) || defined(_M_X64) \
+    || defined(__i386__) || defined(_M_IX86)
+#define NOTEPAD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and clang only allow AVX2 intrinsics in functions built for AVX2, the
+// rest of the file is built for the baseline CPU.
+#if defined(__GNUC__)
+#define NOTEPAD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define NOTEPAD_TARGET_AVX2
+#endif
+
+namespace csi_training {
+
+// Bytes scanned at once, one bit per byte in the masks.
+static const size_t kScanBlockSize = 64;
+// Texts are not split into chunks smaller than this.
+static const size_t kMinChunkSize = 4 * 1024 * 1024;
+
+// Sets a bit in lf_mask for every LF in the block and a bit in high_mask for
+// every byte that is not ASCII.
+typedef void (*ScanBlockFunc)(const char* block,
+                              uint64_t* lf_mask,
+                              uint64_t* high_mask);
+
+static void ScanBlockScalar(const char* block,
+                            uint64_t* lf_mask,
+                            uint64_t* high_mask) {
+  uint64_t lfs = 0;
+  uint64_t highs = 0;
+  for (size_t i = 0; i < kScanBlockSize; ++i) {
+    unsigned char c = static_cast<unsigned char>(block[i]);
+    lfs |= static_cast<uint64_t>(c == LF) << i;
+    highs |= static_cast<uint64_t>(c >> 7) << i;
+  }
+  *lf_mask = lfs;
+  *high_mask = highs;
+}
+
+#ifdef NOTEPAD_X86
+
+static void ScanBlockSse2(const char* block,
+                          uint64_t* lf_mask,
+                          uint64_t* high_mask) {
+  const __m128i lf = _mm_set1_epi8(LF);
+  uint64_t lfs = 0;
+  uint64_t highs = 0;
+  for (int i = 0; i < 4; ++i) {
+    __m128i bytes = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(block + i * 16));
+    uint32_t eq = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, lf));
+    uint32_t high = _mm_movemask_epi8(bytes);
+    lfs |= static_cast<uint64_t>(eq) << (i * 16);
+    highs |= static_cast<uint64_t>(high) << (i * 16);
+  }
+  *lf_mask = lfs;
+  *high_mask = highs;
+}
+
+NOTEPAD_TARGET_AVX2
+static void ScanBlockAvx2(const char* block,
+                          uint64_t* lf_mask,
+                          uint64_t* high_mask) {
+  const __m256i lf = _mm256_set1_epi8(LF);
+  __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+  __m256i hi = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(block + 32));
+  uint32_t lo_eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, lf));
+  uint32_t hi_eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, lf));
+  uint32_t lo_high = _mm256_movemask_epi8(lo);
+  uint32_t hi_high = _mm256_movemask_epi8(hi);
+  *lf_mask = (static_cast<uint64_t>(hi_eq) << 32) | lo_eq;
+  *high_mask = (static_cast<uint64_t>(hi_high) << 32) | lo_high;
+}
+
+#endif  // NOTEPAD_X86
+
+bool IsLineScannerSupported(LineScanner scanner) {
+  switch (scanner) {
+    case kBestScanner:
+    case kScalarScanner:
+      return true;
+#if defined(NOTEPAD_X86) && defined(__GNUC__)
+    case kSse2Scanner:
+      return __builtin_cpu_supports("sse2");
+    case kAvx2Scanner:
+      return __builtin_cpu_supports("avx2");
+#elif defined(NOTEPAD_X86) && defined(_MSC_VER)
+    case kSse2Scanner: {
+      int info[4];
+      __cpuid(info, 1);
+      return (info[3] & (1 << 26)) != 0;
+    }
+    case kAvx2Scanner: {
+      int info[4];
+      __cpuid(info, 1);
+      bool os_saves_avx = (info[2] & (1 << 27)) != 0
+          && (_xgetbv(0) & 6) == 6;
+      if (!os_saves_avx) {
+        return false;
+      }
+      __cpuidex(info, 7, 0);
+      return (info[1] & (1 << 5)) != 0;
+    }
+#endif
+    default:
+      return false;
+  }
+}
+
+static ScanBlockFunc GetScanBlockFunc(LineScanner scanner) {
+  if (scanner == kBestScanner) {
+    if (IsLineScannerSupported(kAvx2Scanner)) {
+      scanner = kAvx2Scanner;
+    } else if (IsLineScannerSupported(kSse2Scanner)) {
+      scanner = kSse2Scanner;
+    } else {
+      scanner = kScalarScanner;
+    }
+  }
+
+#ifdef NOTEPAD_X86
+  if (scanner == kAvx2Scanner && IsLineScannerSupported(kAvx2Scanner)) {
+    return ScanBlockAvx2;
+  }
+  if (scanner == kSse2Scanner && IsLineScannerSupported(kSse2Scanner)) {
+    return ScanBlockSse2;
+  }
+#endif
+  return ScanBlockScalar;
+}
+
+static int CountTrailingZeros(uint64_t x) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return static_cast<int>(index);
+#else
+  int n = 0;
+  while ((x & 1) == 0) {
+    x >>= 1;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+// Gets the wxChar count of a line, only decoding it if it is not ASCII.
+static size_t LineLength(const char* line, size_t len, bool ascii) {
+  return ascii ? len : Utf8DecodedLength(line, len);
+}
+
+// Indexes a chunk that starts at a line start, with offsets relative to it.
+static void IndexChunk(const char* data,
+                       size_t size,
+                       ScanBlockFunc scan_block,
+                       LineIndex* index) {
+  size_t length = 0;
+  size_t line_start = 0;
+  bool line_ascii = true;
+  char last_block[kScanBlockSize];
+
+  for (size_t pos = 0; pos < size; pos += kScanBlockSize) {
+    const char* block = data + pos;
+    if (size - pos < kScanBlockSize) {
+      memset(last_block, 0, kScanBlockSize);
+      memcpy(last_block, block, size - pos);
+      block = last_block;
+    }
+
+    uint64_t lf_mask = 0;
+    uint64_t high_mask = 0;
+    scan_block(block, &lf_mask, &high_mask);
+
+    while (lf_mask != 0) {
+      int bit = CountTrailingZeros(lf_mask);
+      uint64_t line_bits = bit == 63 ? ~0ULL : (2ULL << bit) - 1;
+      if ((high_mask & line_bits) != 0) {
+        line_ascii = false;
+      }
+      high_mask &= ~line_bits;
+      lf_mask &= lf_mask - 1;
+
+      size_t lf = pos + bit;
+      length += LineLength(data + line_start, lf + 1 - line_start, line_ascii);
+      index->byte_line_feeds.push_back(lf);
+      index->line_feeds.push_back(length - 1);
+      line_start = lf + 1;
+      line_ascii = true;
+    }
+    if (high_mask != 0) {
+      line_ascii = false;
+    }
+  }
+
+  length += LineLength(data + line_start, size - line_start, line_ascii);
+  index->length = length;
+}
+
+void IndexLines(const char* data,
+                size_t size,
+                LineIndex* index,
+                LineScanner scanner,
+                int thread_count,
+                TaskScheduler* scheduler,
+                TaskPriority priority) {
+  ScanBlockFunc scan_block = GetScanBlockFunc(scanner);
+  index->byte_line_feeds.clear();
+  index->line_feeds.clear();
+  index->length = 0;
+
+  if (thread_count <= 0 && scheduler != nullptr) {
+    // The calling thread indexes a chunk too.
+    thread_count = scheduler->GetThreadCount() + 1;
+  } else if (thread_count <= 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  size_t chunk_count = std::min(static_cast<size_t>(thread_count),
+                                size / kMinChunkSize);
+
+  // Cut the chunks right after a LF so each starts at a line start and can
+  // be decoded on its own.
+  std::vector<size_t> chunk_starts(1, 0);
+  for (size_t i = 1; i < chunk_count; ++i) {
+    size_t cut = std::max(size / chunk_count * i, chunk_starts.back());
+    const void* lf = memchr(data + cut, LF, size - cut);
+    if (lf == nullptr) {
+      break;
+    }
+    size_t start = static_cast<const char*>(lf) - data + 1;
+    if (start > chunk_starts.back() && start < size) {
+      chunk_starts.push_back(start);
+    }
+  }
+  chunk_starts.push_back(size);
+
+  if (chunk_starts.size() == 2) {
+    IndexChunk(data, size, scan_block, index);
+    return;
+  }
+
+  std::vector<LineIndex> chunks(chunk_starts.size() - 1);
+  if (scheduler != nullptr) {
+    // The chunks no worker has started yet are indexed here by Wait().
+    std::vector<std::shared_ptr<Task> > tasks;
+    for (size_t i = 1; i < chunks.size(); ++i) {
+      const char* chunk_data = data + chunk_starts[i];
+      size_t chunk_size = chunk_starts[i + 1] - chunk_starts[i];
+      LineIndex* chunk = &chunks[i];
+      tasks.push_back(scheduler->Submit(
+          "index lines",
+          priority,
+          [chunk_data, chunk_size, scan_block, chunk](const Task&) {
+            IndexChunk(chunk_data, chunk_size, scan_block, chunk);
+          }));
+    }
+    IndexChunk(data, chunk_starts[1], scan_block, &chunks[0]);
+    for (const std::shared_ptr<Task>& task : tasks) {
+      task->Wait();
+    }
+  } else {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < chunks.size(); ++i) {
+      threads.push_back(std::thread(IndexChunk,
+                                    data + chunk_starts[i],
+                                    chunk_starts[i + 1] - chunk_starts[i],
+                                    scan_block,
+                                    &chunks[i]));
+    }
+    IndexChunk(data, chunk_starts[1], scan_block, &chunks[0]);
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+  // Merge, shifting each chunk by the bytes and chars before it.
+  size_t line_feed_count = 0;
+  for (const LineIndex& chunk : chunks) {
+    line_feed_count += chunk.line_feeds.size();
+  }
+  index->byte_line_feeds.reserve(line_feed_count);
+  index->line_feeds.reserve(line_feed_count);
+
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    const LineIndex& chunk = chunks[i];
+    size_t byte_base = chunk_starts[i];
+    size_t char_base = index->length;
+    for (size_t lf : chunk.byte_line_feeds) {
+      index->byte_line_feeds.push_back(byte_base + lf);
+    }
+    for (size_t lf : chunk.line_feeds) {
+      index->line_feeds.push_back(char_base + lf);
+    }
+    index->length += chunk.length;
+  }
+}
+
+}  // namespace csi_training
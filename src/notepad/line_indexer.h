@@ -0,0 +1,48 @@
+#ifndef NOTEPAD_NOTEPAD_LINE_INDEXER_H_
+#define NOTEPAD_NOTEPAD_LINE_INDEXER_H_
+
+#include <vector>
+
+#include "wx/defs.h"
+
+#include "notepad/task_scheduler.h"
+
+namespace csi_training {
+
+// The line feeds of UTF-8 text.
+struct LineIndex {
+  LineIndex() : length(0) {}
+
+  // Offsets of the LFs in bytes.
+  std::vector<size_t> byte_line_feeds;
+  // Offsets of the LFs in decoded wxChars.
+  std::vector<size_t> line_feeds;
+  // The decoded length in wxChars.
+  size_t length;
+};
+
+enum LineScanner {
+  kBestScanner = 0,  // the fastest one the CPU supports
+  kScalarScanner,
+  kSse2Scanner,
+  kAvx2Scanner
+};
+
+// Gets whether the CPU can run the scanner.
+bool IsLineScannerSupported(LineScanner scanner);
+
+// Indexes the lines of the UTF-8 text. Big texts are split into chunks at
+// line starts and the chunks are indexed on thread_count threads, 0 for one
+// per core. The chunks run as tasks of the given priority of the scheduler
+// if one is given, else on threads of their own.
+void IndexLines(const char* data,
+                size_t size,
+                LineIndex* index,
+                LineScanner scanner = kBestScanner,
+                int thread_count = 0,
+                TaskScheduler* scheduler = nullptr,
+                TaskPriority priority = kTaskPriorityViewport);
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_LINE_INDEXER_H_
@@ -0,0 +1,67 @@
+#include "notepad/line_tiles.h"
+
+namespace csi_training {
+
+// Estimated bytes per pixel of a bitmap.
+static const size_t kPixelBytes = 4;
+
+LineTiles::LineTiles(size_t max_bytes)
+    : max_bytes_(max_bytes)
+    , bytes_(0) {
+}
+
+const wxBitmap* LineTiles::Get(int row, size_t version, int style) {
+  std::unordered_map<int, TileList::iterator>::iterator found =
+      rows_.find(row);
+  if (found == rows_.end()) {
+    return nullptr;
+  }
+  TileList::iterator it = found->second;
+  if (it->version != version || it->style != style) {
+    // The row was edited, moved or highlighted since, it won't be drawn
+    // like this again.
+    Remove(it);
+    return nullptr;
+  }
+  tiles_.splice(tiles_.begin(), tiles_, it);
+  return &it->bitmap;
+}
+
+void LineTiles::Add(int row,
+                    size_t version,
+                    int style,
+                    const wxBitmap& bitmap) {
+  std::unordered_map<int, TileList::iterator>::iterator found =
+      rows_.find(row);
+  if (found != rows_.end()) {
+    Remove(found->second);
+  }
+
+  size_t bytes = static_cast<size_t>(bitmap.GetWidth())
+      * static_cast<size_t>(bitmap.GetHeight()) * kPixelBytes;
+  if (bytes > max_bytes_) {
+    return;
+  }
+  while (bytes_ + bytes > max_bytes_) {
+    Remove(--tiles_.end());
+  }
+
+  Tile tile = { row, version, style, bitmap, bytes };
+  tiles_.push_front(tile);
+  rows_[row] = tiles_.begin();
+  bytes_ += bytes;
+}
+
+void LineTiles::Clear() {
+  tiles_.clear();
+  rows_.clear();
+  bytes_ = 0;
+}
+
+void LineTiles::Remove(TileList::iterator it) {
+  bytes_ -= it->bytes;
+  rows_.erase(it->row);
+  tiles_.erase(it);
+}
+
+}  // namespace csi_training
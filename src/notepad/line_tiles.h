@@ -0,0 +1,54 @@
+#ifndef NOTEPAD_NOTEPAD_LINE_TILES_H_
+#define NOTEPAD_NOTEPAD_LINE_TILES_H_
+
+#include <list>
+#include <unordered_map>
+
+#include "wx/bitmap.h"
+
+namespace csi_training {
+
+// The bitmaps of the rows drawn last, each kept with the version of the row
+// it was drawn from and the style it was drawn in, so unchanged rows are
+// painted with a blit. The least
+// recently used bitmaps are dropped to stay within a memory budget.
+class LineTiles {
+  wxDECLARE_NO_COPY_CLASS(LineTiles);
+
+ public:
+  explicit LineTiles(size_t max_bytes);
+
+  // Gets the bitmap of the row if it was drawn at version in style, nullptr
+  // otherwise. The pointer is valid until the next Add().
+  const wxBitmap* Get(int row, size_t version, int style);
+
+  // Keeps the bitmap of the row drawn at version in style.
+  void Add(int row, size_t version, int style, const wxBitmap& bitmap);
+
+  // Drops all the bitmaps, after the rows are laid out anew.
+  void Clear();
+
+ private:
+  struct Tile {
+    int row;
+    size_t version;
+    int style;
+    wxBitmap bitmap;
+    size_t bytes;
+  };
+
+  typedef std::list<Tile> TileList;
+
+  void Remove(TileList::iterator it);
+
+ private:
+  size_t max_bytes_;
+  size_t bytes_;
+  // The tiles, the one used last first.
+  TileList tiles_;
+  std::unordered_map<int, TileList::iterator> rows_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_LINE_TILES_H_
@@ -0,0 +1,183 @@
+#include "notepad/line_widths.h"
+
+#include <algorithm>
+
+namespace csi_training {
+
+// Enough for the rows on a screen and the ones edited or clicked lately.
+static const size_t kMaxLines = 256;
+
+// Chars per chunk, measuring one costs about as much as a short row.
+static const size_t kChunkLength = 4096;
+
+static const size_t kNoChunk = static_cast<size_t>(-1);
+
+LineWidths::LineWidths(const CharWidths* char_widths,
+                       const TextBuffer* buffer)
+    : char_widths_(char_widths)
+    , buffer_(buffer) {
+}
+
+int LineWidths::GetX(int row, size_t column) {
+  Line& line = GetLine(row);
+  column = std::min(column, line.length);
+  size_t chunk = column / kChunkLength;
+  MeasureChunks(&line, chunk);
+  size_t offset = column - chunk * kChunkLength;
+  if (offset == 0) {
+    return line.chunk_x[chunk];
+  }
+
+  MeasureOffsets(&line, chunk);
+  if (line.offsets.empty()) {
+    return line.chunk_x[chunk]
+        + static_cast<int>(offset) * char_widths_->ascii_width();
+  }
+  return line.chunk_x[chunk] + line.offsets[offset];
+}
+
+size_t LineWidths::GetColumn(int row, int x) {
+  Line& line = GetLine(row);
+  size_t count = GetChunkCount(line);
+  if (count == 0 || x <= 0) {
+    return 0;
+  }
+
+  // The chunks are measured up to the one x is in.
+  while (line.chunk_x.size() <= count && line.chunk_x.back() <= x) {
+    MeasureChunks(&line, line.chunk_x.size());
+  }
+  size_t chunk = std::upper_bound(line.chunk_x.begin(), line.chunk_x.end(), x)
+      - line.chunk_x.begin() - 1;
+  chunk = std::min(chunk, count - 1);
+
+  // The column is found inside its chunk.
+  size_t len = GetChunkLength(line, chunk);
+  int chunk_x = x - line.chunk_x[chunk];
+  MeasureOffsets(&line, chunk);
+  size_t column = 0;
+  if (line.offsets.empty()) {
+    int width = std::max(char_widths_->ascii_width(), 1);
+    column = std::min(static_cast<size_t>((chunk_x + width / 2) / width),
+                      len);
+    return chunk * kChunkLength + column;
+  }
+
+  const std::vector<int>& offsets = line.offsets;
+  size_t right = std::upper_bound(offsets.begin(), offsets.end(), chunk_x)
+      - offsets.begin();
+  if (right == 0) {
+    column = 0;
+  } else if (right == offsets.size()) {
+    column = len;
+  } else {
+    // The first column at the boundary before x, not the inside of a
+    // surrogate pair.
+    size_t left = std::lower_bound(offsets.begin(), offsets.end(),
+                                   offsets[right - 1]) - offsets.begin();
+    if (chunk_x - offsets[left] < (offsets[right] - offsets[left]) / 2) {
+      column = left;
+    } else {
+      column = right;
+    }
+  }
+  return chunk * kChunkLength + column;
+}
+
+void LineWidths::Invalidate(int first_row, int last_row) {
+  for (LineList::iterator it = lines_.begin(); it != lines_.end();) {
+    if (it->row >= first_row && (last_row < 0 || it->row <= last_row)) {
+      rows_.erase(it->row);
+      it = lines_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void LineWidths::InvalidateFrom(int row, size_t column) {
+  std::unordered_map<int, LineList::iterator>::iterator found =
+      rows_.find(row);
+  if (found == rows_.end()) {
+    return;
+  }
+  // The chunks before the one holding column are as they were.
+  Line& line = *found->second;
+  size_t chunk = column / kChunkLength;
+  line.length = static_cast<size_t>(buffer_->GetRowDisplayCharCount(row));
+  if (line.chunk_x.size() > chunk + 1) {
+    line.chunk_x.resize(chunk + 1);
+  }
+  if (line.chunk != kNoChunk && line.chunk >= chunk) {
+    line.chunk = kNoChunk;
+  }
+}
+
+LineWidths::Line& LineWidths::GetLine(int row) {
+  std::unordered_map<int, LineList::iterator>::iterator found =
+      rows_.find(row);
+  if (found != rows_.end()) {
+    lines_.splice(lines_.begin(), lines_, found->second);
+    return lines_.front();
+  }
+
+  // Reuse the offsets of the line used least.
+  if (lines_.size() < kMaxLines) {
+    lines_.push_front(Line());
+  } else {
+    rows_.erase(lines_.back().row);
+    lines_.splice(lines_.begin(), lines_, --lines_.end());
+  }
+  Line& line = lines_.front();
+  line.row = row;
+  line.length = static_cast<size_t>(buffer_->GetRowDisplayCharCount(row));
+  line.chunk_x.assign(1, 0);
+  line.chunk = kNoChunk;
+  rows_[row] = lines_.begin();
+  return line;
+}
+
+void LineWidths::MeasureChunks(Line* line, size_t chunk) {
+  chunk = std::min(chunk, GetChunkCount(*line));
+  while (line->chunk_x.size() <= chunk) {
+    size_t index = line->chunk_x.size() - 1;
+    TextView text = buffer_->GetRowSlice(line->row,
+                                         index * kChunkLength,
+                                         kChunkLength,
+                                         &chunk_text_);
+    line->chunk_x.push_back(line->chunk_x.back()
+                            + char_widths_->GetWidth(text.data(),
+                                                     text.size()));
+  }
+}
+
+void LineWidths::MeasureOffsets(Line* line, size_t chunk) {
+  if (line->chunk == chunk) {
+    return;
+  }
+  line->chunk = chunk;
+  TextView text = buffer_->GetRowSlice(line->row,
+                                       chunk * kChunkLength,
+                                       kChunkLength,
+                                       &chunk_text_);
+
+  bool fixed = char_widths_->IsFixedWidth();
+  for (size_t i = 0; i < text.size() && fixed; ++i) {
+    fixed = text[i] >= 0x20 && text[i] < 0x7F;
+  }
+  if (fixed) {
+    line->offsets.clear();
+  } else {
+    char_widths_->GetPrefixWidths(text.data(), text.size(), &line->offsets);
+  }
+}
+
+size_t LineWidths::GetChunkCount(const Line& line) const {
+  return (line.length + kChunkLength - 1) / kChunkLength;
+}
+
+size_t LineWidths::GetChunkLength(const Line& line, size_t chunk) const {
+  return std::min(kChunkLength, line.length - chunk * kChunkLength);
+}
+
+}  // namespace csi_training
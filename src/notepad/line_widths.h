@@ -0,0 +1,80 @@
+#ifndef NOTEPAD_NOTEPAD_LINE_WIDTHS_H_
+#define NOTEPAD_NOTEPAD_LINE_WIDTHS_H_
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "wx/defs.h"
+
+#include "notepad/char_widths.h"
+#include "notepad/text_buffer.h"
+
+namespace csi_training {
+
+// The x offsets of the char boundaries of the rows used lately, so going
+// from a column to x is a lookup and from x to a column a binary search.
+// Rows are measured in chunks of a few thousand chars: the x of the chunks
+// are measured from the left only as far as they are used, and the offsets
+// inside a chunk only for the chunk used last. So rows of megabytes cost
+// what is shown of them, and hitting a char is relative to its chunk.
+// Chunks of printable ASCII chars in a fixed width font need no offsets.
+class LineWidths {
+  wxDECLARE_NO_COPY_CLASS(LineWidths);
+
+ public:
+  LineWidths(const CharWidths* char_widths, const TextBuffer* buffer);
+
+  // Gets the x of the column in the row, without its line break.
+  int GetX(int row, size_t column);
+
+  // Gets the column nearest to x in the row.
+  size_t GetColumn(int row, int x);
+
+  // Forgets the rows [first_row, last_row] after they are changed, or all
+  // the rows from first_row on if last_row is -1 as they moved.
+  void Invalidate(int first_row, int last_row);
+  // Forgets what follows column in the row, it changed from there on.
+  void InvalidateFrom(int row, size_t column);
+
+ private:
+  struct Line {
+    int row;
+    size_t length;
+    // The x of the chunks measured so far, the first is 0.
+    std::vector<int> chunk_x;
+    // The chunk the offsets are of, -1 for none.
+    size_t chunk;
+    // The x of the char boundaries of the chunk from its start. Empty if
+    // the chunk is measured by the fixed char width.
+    std::vector<int> offsets;
+  };
+
+  typedef std::list<Line> LineList;
+
+  // Gets the line of the row, adding it if it isn't cached, and marks it
+  // as used last.
+  Line& GetLine(int row);
+
+  // Measures the chunks of the line up to chunk, if they aren't yet.
+  void MeasureChunks(Line* line, size_t chunk);
+  // Measures the offsets inside the chunk.
+  void MeasureOffsets(Line* line, size_t chunk);
+
+  size_t GetChunkCount(const Line& line) const;
+  size_t GetChunkLength(const Line& line, size_t chunk) const;
+
+ private:
+  const CharWidths* char_widths_;
+  const TextBuffer* buffer_;
+  // The lines, the one used last first.
+  LineList lines_;
+  std::unordered_map<int, LineList::iterator> rows_;
+  // Holds the chunk measured when it spans several pieces.
+  std::wstring chunk_text_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_LINE_WIDTHS_H_
@@ -0,0 +1,127 @@
+#include "notepad/mapped_file.h"
+
+#ifdef __WINDOWS__
+#include "wx/msw/wrapwin.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace csi_training {
+
+MappedFile::MappedFile()
+    : opened_(false)
+    , data_(nullptr)
+    , size_(0)
+#ifdef __WINDOWS__
+    , mapping_(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+#ifdef __WINDOWS__
+
+bool MappedFile::Open(const wxString& file_path) {
+  Close();
+
+  HANDLE file = ::CreateFileW(file_path.wc_str(),
+                              GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_DELETE,
+                              nullptr,
+                              OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+
+  LARGE_INTEGER file_size;
+  if (!::GetFileSizeEx(file, &file_size)) {
+    ::CloseHandle(file);
+    return false;
+  }
+
+  size_ = static_cast<size_t>(file_size.QuadPart);
+  if (size_ > 0) {
+    mapping_ = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0,
+                                    nullptr);
+    if (mapping_ != nullptr) {
+      data_ = static_cast<const char*>(
+          ::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    }
+  }
+  ::CloseHandle(file);
+
+  if (size_ > 0 && data_ == nullptr) {
+    Close();
+    return false;
+  }
+  opened_ = true;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    ::UnmapViewOfFile(data_);
+  }
+  if (mapping_ != nullptr) {
+    ::CloseHandle(mapping_);
+  }
+  mapping_ = nullptr;
+  data_ = nullptr;
+  size_ = 0;
+  opened_ = false;
+}
+
+#else
+
+bool MappedFile::Open(const wxString& file_path) {
+  Close();
+
+  int fd = open(file_path.fn_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return false;
+  }
+
+  size_ = static_cast<size_t>(file_stat.st_size);
+  if (size_ > 0) {
+    void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      data_ = static_cast<const char*>(data);
+    }
+  }
+  // The mapping keeps the file alive.
+  close(fd);
+
+  if (size_ > 0 && data_ == nullptr) {
+    size_ = 0;
+    return false;
+  }
+  opened_ = true;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  opened_ = false;
+}
+
+#endif  // __WINDOWS__
+
+}  // namespace csi_training
@@ -0,0 +1,37 @@
+#ifndef NOTEPAD_NOTEPAD_MAPPED_FILE_H_
+#define NOTEPAD_NOTEPAD_MAPPED_FILE_H_
+
+#include "wx/defs.h"
+#include "wx/string.h"
+
+namespace csi_training {
+
+// A file mapped read-only into memory.
+class MappedFile {
+  wxDECLARE_NO_COPY_CLASS(MappedFile);
+
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  bool Open(const wxString& file_path);
+  void Close();
+
+  bool IsOpened() const { return opened_; }
+
+  // The data is nullptr for an empty file.
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  bool opened_;
+  const char* data_;
+  size_t size_;
+#ifdef __WINDOWS__
+  void* mapping_;
+#endif
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_MAPPED_FILE_H_
@@ -0,0 +1,266 @@
+#include "notepad/mapped_text.h"
+
+#include <algorithm>
+
+#include "wx/file.h"
+
+#include "notepad/async_io.h"
+#include "notepad/defs.h"
+#include "notepad/utf8.h"
+
+namespace csi_training {
+
+// A block holds at least this many chars, in whole chunks.
+static const size_t kBlockChars = 16 * 1024;
+static const size_t kBlockCount = 4;
+
+// The bytes between checkpoints, a chunk is at most about three times as
+// big. Finding a char costs decoding a chunk at most.
+static const size_t kCheckpointBytes = 16 * 1024;
+
+// Files are read in blocks of this many bytes, a few at a time so the
+// device works on them together.
+static const size_t kReadSize = 1024 * 1024;
+static const size_t kReadsInFlight = 8;
+
+static bool IsContinuationByte(char c) {
+  return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+MappedText::MappedText()
+    : text_(nullptr)
+    , text_size_(0)
+    , has_bom_(false)
+    , is_utf8_(true)
+    , length_(0)
+    , indexed_size_(0)
+    , tick_(0) {
+  Checkpoint start = { 0, 0, true };
+  checkpoints_.push_back(start);
+  // Blocks never move, so the chars handed out stay where they are.
+  blocks_.reserve(kBlockCount);
+}
+
+MappedText::~MappedText() {
+}
+
+bool MappedText::Map(const wxString& file_path) {
+  if (!file_.Open(file_path)) {
+    return false;
+  }
+
+  if (!SetText(file_.data(), file_.size())) {
+    file_.Close();
+    return false;
+  }
+  return true;
+}
+
+bool MappedText::Read(const wxString& file_path) {
+  wxFile file;
+  wxFileOffset size = file.Open(file_path) ? file.Length() : wxInvalidOffset;
+  if (size == wxInvalidOffset) {
+    return false;
+  }
+
+  // The blocks are read straight into place.
+  bytes_.resize(static_cast<size_t>(size));
+  bool read = true;
+  {
+    AsyncIo io(&file, nullptr, kReadsInFlight, 0);
+    for (size_t offset = 0; offset < bytes_.size(); offset += kReadSize) {
+      size_t len = std::min(kReadSize, bytes_.size() - offset);
+      io.Read(&bytes_[offset], len, offset, [&read, len](int64_t result) {
+        if (result != static_cast<int64_t>(len)) {
+          read = false;
+        }
+      });
+    }
+  }
+  if (!read) {
+    std::string().swap(bytes_);
+    return false;
+  }
+  if (!SetText(bytes_.data(), bytes_.size())) {
+    std::string().swap(bytes_);
+    return false;
+  }
+  return true;
+}
+
+void MappedText::Assign(std::string bytes) {
+  bytes_.swap(bytes);
+  text_ = bytes_.data();
+  text_size_ = bytes_.size();
+
+  LineIndex lines;
+  IndexLines(text_, text_size_, &lines);
+  AppendIndex(lines, text_size_);
+}
+
+bool MappedText::SetText(const char* data, size_t size) {
+  text_ = data;
+  text_size_ = size;
+
+  const unsigned char* bom = reinterpret_cast<const unsigned char*>(text_);
+  if (text_size_ >= 2 && ((bom[0] == 0xFF && bom[1] == 0xFE)
+                          || (bom[0] == 0xFE && bom[1] == 0xFF))) {
+    text_ = nullptr;
+    text_size_ = 0;
+    return false;
+  }
+  if (text_size_ >= 3 && bom[0] == 0xEF && bom[1] == 0xBB && bom[2] == 0xBF) {
+    text_ += 3;
+    text_size_ -= 3;
+    has_bom_ = true;
+  }
+  return true;
+}
+
+void MappedText::AppendIndex(const LineIndex& lines, size_t size) {
+  // Only the char offsets of the LFs are kept, the byte offsets of a few
+  // of them start the chunks.
+  size_t byte_base = indexed_size_;
+  size_t char_base = length_;
+  line_feeds_.reserve(line_feeds_.size() + lines.line_feeds.size());
+  for (size_t i = 0; i < lines.line_feeds.size(); ++i) {
+    size_t lf = char_base + lines.line_feeds[i];
+    line_feeds_.push_back(lf);
+    AddCheckpoint(byte_base + lines.byte_line_feeds[i] + 1, lf + 1);
+  }
+  length_ += lines.length;
+  indexed_size_ += size;
+  AddCheckpoint(indexed_size_, length_);
+  // The last chunk may grow with the next lines.
+  SetChunkAscii(checkpoints_.size() - 1);
+}
+
+void MappedText::AddCheckpoint(size_t byte, size_t chars) {
+  while (byte - checkpoints_.back().byte > 2 * kCheckpointBytes) {
+    // A long line, cut it where no sequence is: a lead byte takes at most
+    // three continuation bytes after it.
+    const Checkpoint& last = checkpoints_.back();
+    size_t cut = last.byte + kCheckpointBytes;
+    for (int i = 0; i < 3 && IsContinuationByte(text_[cut]); ++i) {
+      ++cut;
+    }
+    Checkpoint next = {
+      cut,
+      last.chars + Utf8DecodedLength(text_ + last.byte, cut - last.byte),
+      false
+    };
+    checkpoints_.push_back(next);
+    SetChunkAscii(checkpoints_.size() - 2);
+  }
+  if (byte - checkpoints_.back().byte >= kCheckpointBytes) {
+    Checkpoint next = { byte, chars, false };
+    checkpoints_.push_back(next);
+    SetChunkAscii(checkpoints_.size() - 2);
+  }
+}
+
+size_t MappedText::FindChunk(size_t offset) const {
+  std::vector<Checkpoint>::const_iterator it = std::upper_bound(
+      checkpoints_.begin(), checkpoints_.end(), offset,
+      [](size_t chars, const Checkpoint& checkpoint) {
+        return chars < checkpoint.chars;
+      });
+  return (it - checkpoints_.begin()) - 1;
+}
+
+size_t MappedText::GetChunkEnd(size_t chunk) const {
+  return chunk + 1 < checkpoints_.size() ? checkpoints_[chunk + 1].byte
+                                         : indexed_size_;
+}
+
+void MappedText::SetChunkAscii(size_t chunk) {
+  Checkpoint& checkpoint = checkpoints_[chunk];
+  const char* data = text_ + checkpoint.byte;
+  size_t size = GetChunkEnd(chunk) - checkpoint.byte;
+  checkpoint.ascii = IsAscii(data, size);
+  // Batches end at line feeds and long lines are cut between sequences, so
+  // a chunk never ends inside a valid one.
+  if (!checkpoint.ascii && is_utf8_) {
+    is_utf8_ = IsValidUtf8(data, size);
+  }
+}
+
+wxChar MappedText::GetCharAt(size_t offset) const {
+  assert(offset < length_);
+
+  const Checkpoint& checkpoint = checkpoints_[FindChunk(offset)];
+  if (checkpoint.ascii) {
+    return static_cast<wxChar>(
+        text_[checkpoint.byte + (offset - checkpoint.chars)]);
+  }
+  size_t count = 0;
+  return *GetChars(offset, 1, &count);
+}
+
+const wxChar* MappedText::GetChars(size_t offset,
+                                   size_t len,
+                                   size_t* count) const {
+  assert(offset < length_);
+
+  const Block* block = nullptr;
+  for (const Block& b : blocks_) {
+    if (offset >= b.start && offset < b.start + b.chars.size()) {
+      block = &b;
+      break;
+    }
+  }
+  if (block == nullptr) {
+    block = &DecodeBlock(offset);
+  }
+
+  const_cast<Block*>(block)->last_used = ++tick_;
+  size_t block_offset = offset - block->start;
+  *count = std::min(len, block->chars.size() - block_offset);
+  return block->chars.data() + block_offset;
+}
+
+size_t MappedText::DecodeChars(size_t offset,
+                               size_t min_chars,
+                               std::wstring* chars) const {
+  assert(offset < length_);
+
+  size_t first = FindChunk(offset);
+  const Checkpoint& start = checkpoints_[first];
+  size_t last_char = std::min(std::max(offset, start.chars + min_chars - 1),
+                              length_ - 1);
+  size_t last = FindChunk(last_char);
+
+  // ASCII chunks are only widened.
+  chars->clear();
+  for (size_t chunk = first; chunk <= last; ++chunk) {
+    const Checkpoint& checkpoint = checkpoints_[chunk];
+    const char* data = text_ + checkpoint.byte;
+    const char* end = text_ + GetChunkEnd(chunk);
+    if (checkpoint.ascii) {
+      chars->append(data, end);
+    } else {
+      Utf8Decode(data, end - data, chars);
+    }
+  }
+  return start.chars;
+}
+
+const MappedText::Block& MappedText::DecodeBlock(size_t offset) const {
+  Block* block = nullptr;
+  if (blocks_.size() < kBlockCount) {
+    blocks_.push_back(Block());
+    block = &blocks_.back();
+  } else {
+    block = &blocks_[0];
+    for (Block& b : blocks_) {
+      if (b.last_used < block->last_used) {
+        block = &b;
+      }
+    }
+  }
+
+  block->start = DecodeChars(offset, kBlockChars, &block->chars);
+  return *block;
+}
+
+}  // namespace csi_training
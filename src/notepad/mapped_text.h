@@ -0,0 +1,130 @@
+#ifndef NOTEPAD_NOTEPAD_MAPPED_TEXT_H_
+#define NOTEPAD_NOTEPAD_MAPPED_TEXT_H_
+
+#include <string>
+#include <vector>
+
+#include "wx/defs.h"
+#include "wx/string.h"
+
+#include "notepad/line_indexer.h"
+#include "notepad/mapped_file.h"
+
+namespace csi_training {
+
+// UTF-8 text decoded when it is read: a file mapped into memory, or bytes
+// held in memory for small files and big inserts. Only the offsets of its
+// line feeds, the char offset every few kilobytes and a few decoded blocks
+// around what was read last are kept besides the bytes, so it takes about
+// its size in bytes rather than four bytes a char.
+// The text is indexed in batches, it ends where the indexed lines end.
+class MappedText {
+  wxDECLARE_NO_COPY_CLASS(MappedText);
+
+ public:
+  MappedText();
+  ~MappedText();
+
+  // Maps the file, nothing is indexed yet. Returns false if the file can't be
+  // mapped or starts with a UTF-16/UTF-32 BOM.
+  bool Map(const wxString& file_path);
+  // Same, but reads the file into memory, for files too small to map.
+  bool Read(const wxString& file_path);
+
+  // Holds the bytes, which have no BOM, and indexes them all.
+  void Assign(std::string bytes);
+
+  // Gets the mapped bytes after the BOM, if any.
+  const char* text() const { return text_; }
+  size_t text_size() const { return text_size_; }
+  // Whether the bytes start with a UTF-8 BOM, which is written back on save.
+  bool has_bom() const { return has_bom_; }
+  // Whether the bytes indexed so far are all valid UTF-8. If not, some were
+  // decoded as Latin-1 and saving the text changes them.
+  bool is_utf8() const { return is_utf8_; }
+
+  // Appends the lines of the next size bytes after the ones indexed, with
+  // offsets relative to the first of them.
+  void AppendIndex(const LineIndex& lines, size_t size);
+  size_t indexed_size() const { return indexed_size_; }
+
+  // Gets the length in wxChars.
+  size_t GetLength() const { return length_; }
+
+  // Gets the offsets of the LF chars.
+  const std::vector<size_t>& line_feeds() const { return line_feeds_; }
+
+  // Gets the char at offset. Chars of ASCII chunks are read as they are,
+  // without decoding a block.
+  wxChar GetCharAt(size_t offset) const;
+
+  // Gets the chars from offset on, decoding them if needed. *count is set to
+  // the count available at the returned pointer, between 1 and len. The
+  // pointer is valid until the block is evicted, the last block read is
+  // always kept.
+  const wxChar* GetChars(size_t offset, size_t len, size_t* count) const;
+
+  // Decodes the chunk holding offset and those after it, up to at least
+  // min_chars chars, into chars and returns the offset of chars[0]. Unlike
+  // GetChars() it keeps no state, so once the text is indexed it can be
+  // called from any thread.
+  size_t DecodeChars(size_t offset,
+                     size_t min_chars,
+                     std::wstring* chars) const;
+
+ private:
+  struct Block {
+    size_t start;  // offset of chars[0]
+    std::wstring chars;
+    unsigned long long last_used;  // NOLINT
+  };
+
+  // The start of a chunk: its offset in bytes, relative to text_, and in
+  // chars. In an ASCII chunk they are apart by the same count all along.
+  struct Checkpoint {
+    size_t byte;
+    size_t chars;
+    bool ascii;
+  };
+
+  // Skips the BOM of the text, returns false for a UTF-16/UTF-32 one.
+  bool SetText(const char* data, size_t size);
+
+  // Starts a chunk at the char boundary at byte if the last one is big
+  // enough. Long lines are cut into chunks of their own up to it.
+  void AddCheckpoint(size_t byte, size_t chars);
+
+  // Gets the index of the chunk holding the char at offset.
+  size_t FindChunk(size_t offset) const;
+  // Gets the byte offset where the chunk ends.
+  size_t GetChunkEnd(size_t chunk) const;
+  // Sets whether the chunk is ASCII, once its bytes are all indexed, and
+  // checks that they are valid UTF-8 if not.
+  void SetChunkAscii(size_t chunk);
+
+  // Decodes the chunks around offset into the least recently used block.
+  const Block& DecodeBlock(size_t offset) const;
+
+ private:
+  MappedFile file_;
+  // The bytes of a text read into memory, instead of file_.
+  std::string bytes_;
+  // The text after the BOM, if any.
+  const char* text_;
+  size_t text_size_;
+  bool has_bom_;
+  bool is_utf8_;
+  std::vector<size_t> line_feeds_;
+  size_t length_;
+  // The chunks the text is decoded in, the first starts at 0. They start
+  // at line starts every few kilobytes, or inside long lines.
+  std::vector<Checkpoint> checkpoints_;
+  size_t indexed_size_;
+
+  mutable std::vector<Block> blocks_;
+  mutable unsigned long long tick_;  // NOLINT
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_MAPPED_TEXT_H_
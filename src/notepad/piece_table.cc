@@ -0,0 +1,462 @@
+#include "notepad/piece_table.h"
+
+#include "notepad/utf8.h"
+
+namespace csi_training {
+
+// Chars allocated for each add buffer. The buffer never grows beyond it, so
+// the text already appended never moves.
+static const size_t kAddBufferCapacity = 64 * 1024;
+
+PieceTable::Snapshot::~Snapshot() {
+  PieceTable::Release(root_);
+}
+
+PieceTable::PieceTable()
+    : add_buffer_(0)
+    , root_(nullptr)
+    , seed_(2463534242u) {
+  Reset(std::wstring());
+}
+
+PieceTable::~PieceTable() {
+  Release(root_);
+}
+
+void PieceTable::Clear() {
+  Reset(std::wstring());
+}
+
+void PieceTable::Reset(std::wstring original) {
+  Release(root_);
+  root_ = nullptr;
+  // The snapshots keep the old list.
+  buffers_ = std::make_shared<BufferList>();
+  add_buffer_ = 0;
+
+  std::shared_ptr<Buffer> buffer(new Buffer);
+  buffer->text.swap(original);
+  const std::wstring& text = buffer->text;
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == LF) {
+      buffer->line_feeds.push_back(i);
+    }
+  }
+  buffers_->push_back(std::move(buffer));
+
+  const Buffer* original_buffer = (*buffers_)[0].get();
+  if (!original_buffer->text.empty()) {
+    Piece piece = { 0, 0, original_buffer->text.size(),
+                    original_buffer->line_feeds.size() };
+    root_ = NewNode(piece);
+  }
+}
+
+void PieceTable::Reset(std::unique_ptr<MappedText> original) {
+  Reset(std::wstring());
+
+  size_t length = original->GetLength();
+  size_t line_feeds = original->line_feeds().size();
+  (*buffers_)[0]->mapped = std::move(original);
+  if (length > 0) {
+    Piece piece = { 0, 0, length, line_feeds };
+    root_ = NewNode(piece);
+  }
+}
+
+void PieceTable::AppendOriginal(const LineIndex& lines, size_t size) {
+  MappedText* mapped = (*buffers_)[0]->mapped.get();
+  assert(mapped != nullptr);
+  assert(root_ == nullptr
+         || (root_->left == nullptr && root_->right == nullptr
+             && root_->piece.buffer == 0 && root_->piece.start == 0));
+
+  mapped->AppendIndex(lines, size);
+  if (mapped->GetLength() == 0) {
+    return;
+  }
+
+  Piece piece = { 0, 0, mapped->GetLength(), mapped->line_feeds().size() };
+  if (root_ == nullptr) {
+    root_ = NewNode(piece);
+  } else {
+    root_ = Own(root_);
+    root_->piece = piece;
+    Update(root_);
+  }
+}
+
+const MappedText* PieceTable::GetMappedOriginal() const {
+  return (*buffers_)[0]->mapped.get();
+}
+
+const std::vector<size_t>& PieceTable::GetOriginalLineFeeds() const {
+  return BufferLineFeeds(0);
+}
+
+size_t PieceTable::GetLength() const {
+  return Length(root_);
+}
+
+size_t PieceTable::GetLineFeedCount() const {
+  return LineFeeds(root_);
+}
+
+size_t PieceTable::GetLineStart(size_t line) const {
+  if (line == 0) {
+    return 0;
+  }
+  if (line > GetLineFeedCount()) {
+    return GetLength();
+  }
+
+  // Find the line-th LF, the line starts right after it.
+  size_t base = 0;
+  size_t k = line;
+  const Node* node = root_;
+  while (node != nullptr) {
+    size_t left_lf = LineFeeds(node->left);
+    if (k <= left_lf) {
+      node = node->left;
+      continue;
+    }
+    k -= left_lf;
+    base += Length(node->left);
+
+    const Piece& piece = node->piece;
+    if (k <= piece.line_feeds) {
+      const std::vector<size_t>& lfs = BufferLineFeeds(piece.buffer);
+      size_t first = std::lower_bound(lfs.begin(), lfs.end(), piece.start)
+          - lfs.begin();
+      return base + lfs[first + k - 1] - piece.start + 1;
+    }
+    k -= piece.line_feeds;
+    base += piece.length;
+    node = node->right;
+  }
+  return GetLength();
+}
+
+size_t PieceTable::GetLineLength(size_t line) const {
+  if (line >= GetLineCount()) {
+    return 0;
+  }
+  return GetLineStart(line + 1) - GetLineStart(line);
+}
+
+size_t PieceTable::GetLineAt(size_t offset) const {
+  // Count the LFs before offset.
+  size_t line = 0;
+  const Node* node = root_;
+  while (node != nullptr) {
+    size_t left_len = Length(node->left);
+    if (offset < left_len) {
+      node = node->left;
+      continue;
+    }
+    offset -= left_len;
+    line += LineFeeds(node->left);
+
+    const Piece& piece = node->piece;
+    if (offset < piece.length) {
+      return line + CountLineFeeds(piece.buffer, piece.start, offset);
+    }
+    offset -= piece.length;
+    line += piece.line_feeds;
+    node = node->right;
+  }
+  return line;
+}
+
+wxChar PieceTable::GetCharAt(size_t offset) const {
+  const Node* node = root_;
+  while (node != nullptr) {
+    size_t left_len = Length(node->left);
+    if (offset < left_len) {
+      node = node->left;
+      continue;
+    }
+    offset -= left_len;
+    const Piece& piece = node->piece;
+    if (offset < piece.length) {
+      const Buffer* buffer = (*buffers_)[piece.buffer].get();
+      if (buffer->mapped) {
+        return buffer->mapped->GetCharAt(piece.start + offset);
+      }
+      return buffer->data()[piece.start + offset];
+    }
+    offset -= piece.length;
+    node = node->right;
+  }
+  return L'\0';
+}
+
+void PieceTable::GetText(size_t offset,
+                         size_t len,
+                         std::wstring* text) const {
+  ForEachRun(offset, len, [text](const wxChar* data, size_t n) {
+    text->append(data, n);
+  });
+}
+
+void PieceTable::Insert(size_t offset, const wxChar* text, size_t len) {
+  if (len == 0 || offset > GetLength()) {
+    return;
+  }
+
+  size_t add_buffer = add_buffer_;
+  size_t add_end =
+      add_buffer != 0 ? (*buffers_)[add_buffer]->size : 0;
+  Piece piece = AppendToAddBuffer(text, len);
+
+  // Typing appends to the piece that was inserted last, so grow it instead
+  // of adding a new piece for every char.
+  if (offset > 0 && piece.buffer == add_buffer && piece.start == add_end) {
+    if (ExtendPieceAt(&root_, offset, piece.length, piece.line_feeds)) {
+      return;
+    }
+  }
+
+  Node* left = nullptr;
+  Node* right = nullptr;
+  Split(root_, offset, &left, &right);
+  root_ = Merge(Merge(left, NewNode(piece)), right);
+}
+
+void PieceTable::Delete(size_t offset, size_t len) {
+  if (len == 0 || offset >= GetLength()) {
+    return;
+  }
+
+  Node* left = nullptr;
+  Node* middle = nullptr;
+  Node* right = nullptr;
+  Split(root_, offset, &left, &right);
+  Split(right, len, &middle, &right);
+  Release(middle);
+  root_ = Merge(left, right);
+}
+
+std::shared_ptr<const PieceTable::Snapshot> PieceTable::TakeSnapshot() const {
+  // The tree is shared, the next edits copy the nodes they change.
+  std::shared_ptr<Snapshot> snapshot(new Snapshot);
+  snapshot->buffers_ = buffers_;
+  snapshot->root_ = Ref(root_);
+  return snapshot;
+}
+
+PieceTable::Node* PieceTable::NewNode(const Piece& piece) {
+  // xorshift32, a fixed seed keeps the tree shape reproducible.
+  seed_ ^= seed_ << 13;
+  seed_ ^= seed_ >> 17;
+  seed_ ^= seed_ << 5;
+  return new Node(piece, seed_);
+}
+
+PieceTable::Node* PieceTable::Ref(Node* node) {
+  if (node != nullptr) {
+    node->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  return node;
+}
+
+void PieceTable::Release(Node* node) {
+  if (node != nullptr
+      && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    Release(node->left);
+    Release(node->right);
+    delete node;
+  }
+}
+
+PieceTable::Node* PieceTable::Own(Node* node) {
+  if (node == nullptr
+      || node->refs.load(std::memory_order_acquire) == 1) {
+    return node;
+  }
+  Node* copy = new Node(node->piece, node->priority);
+  copy->left = Ref(node->left);
+  copy->right = Ref(node->right);
+  copy->length = node->length;
+  copy->line_feeds = node->line_feeds;
+  Release(node);
+  return copy;
+}
+
+void PieceTable::Update(Node* node) {
+  node->length = Length(node->left) + node->piece.length
+      + Length(node->right);
+  node->line_feeds = LineFeeds(node->left) + node->piece.line_feeds
+      + LineFeeds(node->right);
+}
+
+void PieceTable::Split(Node* node, size_t offset, Node** left, Node** right) {
+  if (node == nullptr) {
+    *left = nullptr;
+    *right = nullptr;
+    return;
+  }
+
+  node = Own(node);
+  size_t left_len = Length(node->left);
+  if (offset <= left_len) {
+    Split(node->left, offset, left, &node->left);
+    Update(node);
+    *right = node;
+    return;
+  }
+
+  size_t piece_end = left_len + node->piece.length;
+  if (offset >= piece_end) {
+    Split(node->right, offset - piece_end, &node->right, right);
+    Update(node);
+    *left = node;
+    return;
+  }
+
+  // The offset is inside this piece, cut it in two.
+  Piece& head = node->piece;
+  Piece tail = head;
+  size_t head_len = offset - left_len;
+  head.length = head_len;
+  head.line_feeds = CountLineFeeds(head.buffer, head.start, head.length);
+  tail.start += head_len;
+  tail.length -= head_len;
+  tail.line_feeds -= head.line_feeds;
+
+  // Keep the priority so the heap order still holds in the right tree.
+  Node* tail_node = new Node(tail, node->priority);
+  tail_node->right = node->right;
+  node->right = nullptr;
+  Update(tail_node);
+  Update(node);
+  *left = node;
+  *right = tail_node;
+}
+
+PieceTable::Node* PieceTable::Merge(Node* left, Node* right) {
+  if (left == nullptr) {
+    return right;
+  }
+  if (right == nullptr) {
+    return left;
+  }
+
+  if (left->priority > right->priority) {
+    left = Own(left);
+    left->right = Merge(left->right, right);
+    Update(left);
+    return left;
+  } else {
+    right = Own(right);
+    right->left = Merge(left, right->left);
+    Update(right);
+    return right;
+  }
+}
+
+const std::vector<size_t>& PieceTable::BufferLineFeeds(size_t buffer) const {
+  const Buffer* data = (*buffers_)[buffer].get();
+  if (data->mapped) {
+    return data->mapped->line_feeds();
+  }
+  return data->line_feeds;
+}
+
+size_t PieceTable::CountLineFeeds(size_t buffer,
+                                  size_t start,
+                                  size_t len) const {
+  const std::vector<size_t>& lfs = BufferLineFeeds(buffer);
+  return std::lower_bound(lfs.begin(), lfs.end(), start + len)
+      - std::lower_bound(lfs.begin(), lfs.end(), start);
+}
+
+bool PieceTable::ExtendPieceAt(Node** node_ptr,
+                               size_t offset,
+                               size_t len,
+                               size_t lf) {
+  if (*node_ptr == nullptr) {
+    return false;
+  }
+
+  // The path is copied if shared, a failed search leaves equal copies.
+  Node* node = *node_ptr = Own(*node_ptr);
+  size_t left_len = Length(node->left);
+  size_t piece_end = left_len + node->piece.length;
+  bool extended = false;
+  if (offset <= left_len) {
+    extended = ExtendPieceAt(&node->left, offset, len, lf);
+  } else if (offset > piece_end) {
+    extended = ExtendPieceAt(&node->right, offset - piece_end, len, lf);
+  } else if (offset == piece_end) {
+    Piece& piece = node->piece;
+    if (piece.buffer == add_buffer_
+        && piece.start + piece.length + len
+            == (*buffers_)[add_buffer_]->size) {
+      piece.length += len;
+      piece.line_feeds += lf;
+      extended = true;
+    }
+  }
+
+  if (extended) {
+    node->length += len;
+    node->line_feeds += lf;
+  }
+  return extended;
+}
+
+PieceTable::Piece PieceTable::AppendToAddBuffer(const wxChar* text,
+                                                size_t len) {
+  size_t buffer_index = add_buffer_;
+  Buffer* buffer = nullptr;
+  size_t start = 0;
+  if (len > kAddBufferCapacity / 2) {
+    // Big inserts get a buffer of their own, kept as UTF-8 unless they
+    // don't decode to the same chars, as lone surrogates don't.
+    std::string bytes;
+    Utf8Encode(text, len, &bytes);
+    std::unique_ptr<MappedText> mapped(new MappedText);
+    mapped->Assign(std::move(bytes));
+    buffer_index = AddBuffer();
+    buffer = (*buffers_)[buffer_index].get();
+    if (mapped->GetLength() == len) {
+      Piece piece = { buffer_index, 0, len, mapped->line_feeds().size() };
+      buffer->mapped = std::move(mapped);
+      return piece;
+    }
+    buffer->text.assign(text, len);
+  } else {
+    if (buffer_index == 0
+        || (*buffers_)[buffer_index]->size + len > kAddBufferCapacity) {
+      buffer_index = AddBuffer();
+      (*buffers_)[buffer_index]->chars.reset(new wxChar[kAddBufferCapacity]);
+      add_buffer_ = buffer_index;
+    }
+    // Only chars past the ones the pieces refer to are written, the buffer
+    // may be shared.
+    buffer = (*buffers_)[buffer_index].get();
+    start = buffer->size;
+    std::copy(text, text + len, buffer->chars.get() + start);
+    buffer->size += len;
+  }
+
+  Piece piece = { buffer_index, start, len, 0 };
+  for (size_t i = 0; i < len; ++i) {
+    if (text[i] == LF) {
+      buffer->line_feeds.push_back(start + i);
+      ++piece.line_feeds;
+    }
+  }
+  return piece;
+}
+
+size_t PieceTable::AddBuffer() {
+  if (buffers_.use_count() > 1) {
+    buffers_ = std::make_shared<BufferList>(*buffers_);
+  }
+  buffers_->push_back(std::make_shared<Buffer>());
+  return buffers_->size() - 1;
+}
+
+}  // namespace csi_training
@@ -0,0 +1,325 @@
+#ifndef NOTEPAD_NOTEPAD_PIECE_TABLE_H_
+#define NOTEPAD_NOTEPAD_PIECE_TABLE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "wx/defs.h"
+
+#include "notepad/defs.h"
+#include "notepad/mapped_text.h"
+
+namespace csi_training {
+
+// Stores the document as a sequence of pieces. The original text is never
+// modified, inserted text is appended to add buffers, and the pieces are kept
+// in a treap with cached lengths and line feed counts so that offset and line
+// lookups, inserts and deletes are O(log n).
+// Offsets are in wxChar units. A line ends after its LF, so the document
+// always has GetLineFeedCount() + 1 lines.
+// The nodes are shared with the snapshots taken: a node a snapshot shares is
+// never changed but copied, so an edit copies only the O(log n) nodes on its
+// paths and taking a snapshot is O(1).
+class PieceTable {
+  wxDECLARE_NO_COPY_CLASS(PieceTable);
+
+ public:
+  class Snapshot;
+
+  PieceTable();
+  ~PieceTable();
+
+  // Removes all the text.
+  void Clear();
+
+  // Replaces the whole document with the given original text.
+  void Reset(std::wstring original);
+  // Same, but the original text is kept as UTF-8 and decoded when read.
+  void Reset(std::unique_ptr<MappedText> original);
+
+  // Appends lines indexed later to the mapped original text. Only valid
+  // while the document is still the untouched original.
+  void AppendOriginal(const LineIndex& lines, size_t size);
+
+  // Gets the UTF-8 original text, nullptr if it is kept as wxChars.
+  const MappedText* GetMappedOriginal() const;
+
+  // Gets the offsets of the LFs in the original text.
+  const std::vector<size_t>& GetOriginalLineFeeds() const;
+
+  size_t GetLength() const;
+  size_t GetLineFeedCount() const;
+  size_t GetLineCount() const { return GetLineFeedCount() + 1; }
+
+  // Gets the offset of the first char of the line.
+  size_t GetLineStart(size_t line) const;
+  // Gets the char count of the line, including its LF.
+  size_t GetLineLength(size_t line) const;
+  // Gets the line holding the char at offset, the last line for the end.
+  size_t GetLineAt(size_t offset) const;
+
+  wxChar GetCharAt(size_t offset) const;
+
+  // Appends the chars in [offset, offset + len) to text.
+  void GetText(size_t offset, size_t len, std::wstring* text) const;
+
+  // Calls func(const wxChar* data, size_t len) for every contiguous run of
+  // chars in [offset, offset + len), in document order. Runs of mapped text
+  // are only valid during the call.
+  template <typename Func>
+  void ForEachRun(size_t offset, size_t len, Func func) const {
+    VisitRuns(root_, offset, len, func);
+  }
+
+  void Insert(size_t offset, const wxChar* text, size_t len);
+  void Delete(size_t offset, size_t len);
+
+  // Takes an immutable version of the document, O(1). The mapped original
+  // text, if any, must be completely indexed.
+  std::shared_ptr<const Snapshot> TakeSnapshot() const;
+
+ private:
+  struct Buffer {
+    Buffer() : size(0) {}
+
+    const wxChar* data() const { return chars ? chars.get() : text.data(); }
+
+    // The chars of a buffer that is filled once, as the original text.
+    std::wstring text;
+    // Set instead of text for an add buffer. It is allocated once and only
+    // written past size, so the chars the pieces refer to never change or
+    // move and snapshots read them while more are appended. size is only
+    // used on the UI thread.
+    std::unique_ptr<wxChar[]> chars;
+    size_t size;
+    // Offsets of the LF chars in the buffer.
+    std::vector<size_t> line_feeds;
+    // Set instead of text and line_feeds for text kept as UTF-8: the
+    // original text, and big inserts.
+    std::unique_ptr<MappedText> mapped;
+  };
+
+  typedef std::vector<std::shared_ptr<Buffer>> BufferList;
+
+  struct Piece {
+    size_t buffer;
+    size_t start;
+    size_t length;
+    size_t line_feeds;
+  };
+
+  struct Node {
+    explicit Node(const Piece& p, unsigned int prio)
+        : piece(p), priority(prio), left(nullptr), right(nullptr)
+        , length(p.length), line_feeds(p.line_feeds), refs(1) {
+    }
+
+    Piece piece;
+    unsigned int priority;
+    Node* left;
+    Node* right;
+    // Cached sums over the subtree.
+    size_t length;
+    size_t line_feeds;
+    // The parents and the roots referring to the node. Only the UI thread
+    // adds references, snapshots may drop theirs on any thread.
+    std::atomic<int> refs;
+  };
+
+  Node* NewNode(const Piece& piece);
+
+  // Adds/drops a reference to the node, the node and the nodes only it
+  // refers to are deleted with the last one.
+  static Node* Ref(Node* node);
+  static void Release(Node* node);
+
+  // Gets the node to change in place of node, which it takes the reference
+  // of: node itself unless it is shared, else a copy sharing its children.
+  static Node* Own(Node* node);
+
+  static size_t Length(const Node* node) {
+    return node != nullptr ? node->length : 0;
+  }
+  static size_t LineFeeds(const Node* node) {
+    return node != nullptr ? node->line_feeds : 0;
+  }
+  static void Update(Node* node);
+
+  // Splits the tree so that left holds the first offset chars. Split and
+  // Merge take the references of the trees they are given.
+  void Split(Node* node, size_t offset, Node** left, Node** right);
+  Node* Merge(Node* left, Node* right);
+
+  const std::vector<size_t>& BufferLineFeeds(size_t buffer) const;
+
+  // Counts the LFs in [start, start + len) of the buffer.
+  size_t CountLineFeeds(size_t buffer, size_t start, size_t len) const;
+
+  // Grows the piece ending at offset by len chars if it is the last piece
+  // appended to the current add buffer. Returns false if there is none.
+  bool ExtendPieceAt(Node** node, size_t offset, size_t len, size_t lf);
+
+  // Appends text to an add buffer and returns the piece that refers to it.
+  Piece AppendToAddBuffer(const wxChar* text, size_t len);
+
+  // Adds an empty buffer and returns its index. The list is copied first if
+  // snapshots share it.
+  size_t AddBuffer();
+
+  template <typename Func>
+  void VisitRuns(const Node* node, size_t offset, size_t len,
+                 Func& func) const {
+    if (node == nullptr || len == 0) {
+      return;
+    }
+    size_t left_len = Length(node->left);
+    if (offset < left_len) {
+      size_t n = std::min(len, left_len - offset);
+      VisitRuns(node->left, offset, n, func);
+      offset += n;
+      len -= n;
+    }
+    if (len == 0) {
+      return;
+    }
+    offset -= left_len;
+    const Piece& piece = node->piece;
+    if (offset < piece.length) {
+      size_t n = std::min(len, piece.length - offset);
+      const Buffer* buffer = (*buffers_)[piece.buffer].get();
+      if (buffer->mapped) {
+        for (size_t done = 0; done < n;) {
+          size_t count = 0;
+          const wxChar* data = buffer->mapped->GetChars(
+              piece.start + offset + done, n - done, &count);
+          func(data, count);
+          done += count;
+        }
+      } else {
+        func(buffer->data() + piece.start + offset, n);
+      }
+      offset += n;
+      len -= n;
+    }
+    if (len > 0) {
+      VisitRuns(node->right, offset - piece.length, len, func);
+    }
+  }
+
+ private:
+  // Shared with the snapshots taken, it is never changed once shared.
+  std::shared_ptr<BufferList> buffers_;
+  // Index of the add buffer new text is appended to. Buffer 0 is the
+  // original text, so 0 means there is no add buffer yet.
+  size_t add_buffer_;
+  Node* root_;
+  unsigned int seed_;
+};
+
+// The text of a PieceTable when the snapshot was taken. It shares the nodes
+// of the table, which are not changed while shared, and its buffers, whose
+// chars never change or move once a piece refers to them, so it can be read
+// on another thread while the table is edited, without locks.
+class PieceTable::Snapshot {
+  wxDECLARE_NO_COPY_CLASS(Snapshot);
+
+ public:
+  Snapshot() : root_(nullptr) {}
+  ~Snapshot();
+
+  size_t GetLength() const { return Length(root_); }
+  size_t GetLineFeedCount() const { return LineFeeds(root_); }
+
+  // Gets the UTF-8 original text, nullptr if it is kept as wxChars.
+  const MappedText* GetMappedOriginal() const {
+    return (*buffers_)[0]->mapped.get();
+  }
+
+  // Calls func(const wxChar* data, size_t len) for every contiguous run of
+  // chars, in document order. The runs are only valid during the call.
+  template <typename Func>
+  void ForEachRun(Func func) const {
+    ForEachRunFrom(0, [&func](const wxChar* data, size_t len) {
+      func(data, len);
+      return true;
+    });
+  }
+
+  // Same for the chars from offset on, until func returns false.
+  template <typename Func>
+  void ForEachRunFrom(size_t offset, Func func) const {
+    // The path to the piece holding offset, the nodes whose pieces and
+    // right subtrees are left to visit.
+    std::vector<const Node*> stack;
+    size_t skip = 0;
+    for (const Node* node = root_; node != nullptr;) {
+      size_t left_len = Length(node->left);
+      if (offset < left_len) {
+        stack.push_back(node);
+        node = node->left;
+      } else if (offset < left_len + node->piece.length) {
+        stack.push_back(node);
+        skip = offset - left_len;
+        break;
+      } else {
+        offset -= left_len + node->piece.length;
+        node = node->right;
+      }
+    }
+
+    std::wstring decoded;
+    while (!stack.empty()) {
+      const Node* node = stack.back();
+      stack.pop_back();
+      if (!VisitPiece(node->piece, skip, &decoded, func)) {
+        return;
+      }
+      skip = 0;
+      for (const Node* next = node->right; next != nullptr;
+           next = next->left) {
+        stack.push_back(next);
+      }
+    }
+  }
+
+ private:
+  friend class PieceTable;
+
+  static const size_t kDecodeChars = 256 * 1024;
+
+  // Calls func for the chars of the piece from skip on, returns false if
+  // func did.
+  template <typename Func>
+  bool VisitPiece(const Piece& piece,
+                  size_t skip,
+                  std::wstring* decoded,
+                  Func& func) const {
+    const Buffer* buffer = (*buffers_)[piece.buffer].get();
+    if (!buffer->mapped) {
+      return func(buffer->data() + piece.start + skip,
+                  piece.length - skip);
+    }
+    // UTF-8 text is decoded a few chunks at a time.
+    size_t end = piece.start + piece.length;
+    for (size_t start = piece.start + skip; start < end;) {
+      size_t first = buffer->mapped->DecodeChars(start, kDecodeChars,
+                                                 decoded);
+      size_t n = std::min(end, first + decoded->size()) - start;
+      if (!func(decoded->data() + (start - first), n)) {
+        return false;
+      }
+      start += n;
+    }
+    return true;
+  }
+
+  std::shared_ptr<const BufferList> buffers_;
+  Node* root_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_PIECE_TABLE_H_
@@ -0,0 +1,63 @@
+#include "notepad/row_states.h"
+
+#include <algorithm>
+
+namespace csi_training {
+
+// The least the gap grows by, so pasting rows one at a time doesn't copy
+// all the states every time.
+static const size_t kMinGapSize = 1024;
+
+RowStates::RowStates() : gap_start_(0), gap_end_(0) {
+}
+
+void RowStates::Assign(int count, int state) {
+  states_.assign(static_cast<size_t>(count), state);
+  gap_start_ = gap_end_ = states_.size();
+}
+
+void RowStates::Clear() {
+  states_.clear();
+  gap_start_ = gap_end_ = 0;
+}
+
+void RowStates::Replace(int row, int old_count, int new_count, int state) {
+  MoveGap(static_cast<size_t>(row));
+  gap_end_ += static_cast<size_t>(old_count);
+  size_t count = static_cast<size_t>(new_count);
+  if (GapSize() < count) {
+    GrowGap(count);
+  }
+  std::fill(states_.begin() + gap_start_,
+            states_.begin() + gap_start_ + count,
+            state);
+  gap_start_ += count;
+}
+
+void RowStates::MoveGap(size_t row) {
+  std::vector<int>::iterator begin = states_.begin();
+  if (row < gap_start_) {
+    std::copy_backward(begin + row, begin + gap_start_, begin + gap_end_);
+    gap_end_ -= gap_start_ - row;
+    gap_start_ = row;
+  } else if (row > gap_start_) {
+    size_t count = row - gap_start_;
+    std::copy(begin + gap_end_, begin + gap_end_ + count, begin + gap_start_);
+    gap_start_ += count;
+    gap_end_ += count;
+  }
+}
+
+void RowStates::GrowGap(size_t size) {
+  // The gap grows with the rows, so inserts take amortized O(1) copies.
+  size_t rows = states_.size() - GapSize();
+  size_t gap = std::max(size, std::max(rows / 8, kMinGapSize));
+  std::vector<int> states(rows + gap);
+  std::copy(states_.begin(), states_.begin() + gap_start_, states.begin());
+  std::copy(states_.begin() + gap_end_, states_.end(),
+            states.begin() + gap_start_ + gap);
+  states_.swap(states);
+  gap_end_ = gap_start_ + gap;
+}
+
+}  // namespace csi_training
@@ -0,0 +1,52 @@
+#ifndef NOTEPAD_NOTEPAD_ROW_STATES_H_
+#define NOTEPAD_NOTEPAD_ROW_STATES_H_
+
+#include <vector>
+
+#include "wx/defs.h"
+
+namespace csi_training {
+
+// The state each row of a buffer starts in, in a gap buffer. The gap is
+// moved to the rows edited, so inserting or removing rows shifts only the
+// states between the last edit and this one, not all the rows after it.
+class RowStates {
+  wxDECLARE_NO_COPY_CLASS(RowStates);
+
+ public:
+  RowStates();
+
+  // Sets count rows in state.
+  void Assign(int count, int state);
+  void Clear();
+
+  int size() const { return static_cast<int>(states_.size() - GapSize()); }
+
+  int& operator[](int row) { return states_[Index(row)]; }
+  int operator[](int row) const { return states_[Index(row)]; }
+
+  // Replaces old_count rows from row with new_count rows in state.
+  void Replace(int row, int old_count, int new_count, int state);
+
+ private:
+  size_t GapSize() const { return gap_end_ - gap_start_; }
+  size_t Index(int row) const {
+    size_t index = static_cast<size_t>(row);
+    return index < gap_start_ ? index : index + GapSize();
+  }
+
+  // Moves the gap to start at row.
+  void MoveGap(size_t row);
+  // Makes the gap at least size states long.
+  void GrowGap(size_t size);
+
+ private:
+  std::vector<int> states_;
+  // The states in [gap_start_, gap_end_) are unused.
+  size_t gap_start_;
+  size_t gap_end_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_ROW_STATES_H_
@@ -0,0 +1,212 @@
+#include "notepad/task_scheduler.h"
+
+#include <algorithm>
+
+namespace csi_training {
+
+// The scheduler and the index of the worker running on this thread, if
+// any, so the tasks it submits go to its own deques.
+static thread_local TaskScheduler* current_scheduler = nullptr;
+static thread_local size_t current_worker = 0;
+
+static int64_t Microseconds(Task::Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
+Task::Task(TaskScheduler* scheduler,
+           const char* name,
+           TaskPriority priority,
+           Func func)
+    : scheduler_(scheduler)
+    , name_(name)
+    , priority_(priority)
+    , func_(std::move(func))
+    , cancelled_(std::make_shared<std::atomic<bool> >(false))
+    , state_(kQueued)
+    , queued_at_(Clock::now()) {
+}
+
+void Task::Wait() {
+  if (Claim()) {
+    scheduler_->Execute(this);
+    return;
+  }
+  std::unique_lock<std::mutex> lock(done_mutex_);
+  done_.wait(lock, [this] { return state_ == kDone; });
+}
+
+void Task::CallAfter(wxEvtHandler* handler,
+                     std::function<void()> func) const {
+  std::shared_ptr<std::atomic<bool> > cancelled = cancelled_;
+  handler->CallAfter([cancelled, func]() {
+    if (!*cancelled) {
+      func();
+    }
+  });
+}
+
+int64_t Task::GetQueuedTime() const {
+  return Microseconds(started_at_ - queued_at_);
+}
+
+int64_t Task::GetRunTime() const {
+  return Microseconds(finished_at_ - started_at_);
+}
+
+bool Task::Claim() {
+  int expected = kQueued;
+  return state_.compare_exchange_strong(expected, kRunning);
+}
+
+void Task::Finish() {
+  {
+    std::lock_guard<std::mutex> lock(done_mutex_);
+    state_ = kDone;
+  }
+  done_.notify_all();
+}
+
+/////////////////////////////////////////
+
+TaskScheduler::TaskScheduler(int thread_count)
+    : next_worker_(0)
+    , queued_(0)
+    , stopping_(false) {
+  if (thread_count <= 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // The deques are all in place before a worker looks for tasks.
+  for (int i = 0; i < thread_count; ++i) {
+    workers_.push_back(std::unique_ptr<Worker>(new Worker));
+  }
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    workers_[i]->thread = std::thread(&TaskScheduler::WorkerLoop, this, i);
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  for (const std::unique_ptr<Worker>& worker : workers_) {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    for (const std::deque<std::shared_ptr<Task> >& tasks : worker->tasks) {
+      for (const std::shared_ptr<Task>& task : tasks) {
+        task->Cancel();
+      }
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (const std::unique_ptr<Worker>& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+std::shared_ptr<Task> TaskScheduler::Submit(const char* name,
+                                            TaskPriority priority,
+                                            Task::Func func) {
+  std::shared_ptr<Task> task(new Task(this, name, priority,
+                                      std::move(func)));
+  size_t index = current_scheduler == this
+      ? current_worker
+      : next_worker_.fetch_add(1) % workers_.size();
+  {
+    std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+    workers_[index]->tasks[priority].push_back(task);
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    ++queued_;
+  }
+  wake_.notify_one();
+  return task;
+}
+
+std::vector<TaskStats> TaskScheduler::GetStats() const {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  std::vector<TaskStats> stats;
+  for (const std::pair<const std::string, TaskStats>& entry : stats_) {
+    stats.push_back(entry.second);
+  }
+  return stats;
+}
+
+void TaskScheduler::WorkerLoop(size_t index) {
+  current_scheduler = this;
+  current_worker = index;
+  while (true) {
+    std::shared_ptr<Task> task = FindTask(index);
+    if (task) {
+      // Tasks waited for are run by the waiting thread.
+      if (task->Claim()) {
+        Execute(task.get());
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    if (stopping_ && queued_ == 0) {
+      return;
+    }
+    wake_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+  }
+}
+
+std::shared_ptr<Task> TaskScheduler::FindTask(size_t index) {
+  std::shared_ptr<Task> task;
+  for (int priority = 0; priority < kTaskPriorityCount; ++priority) {
+    // The task queued last is likely still in the cache.
+    {
+      Worker* worker = workers_[index].get();
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      std::deque<std::shared_ptr<Task> >& tasks = worker->tasks[priority];
+      if (!tasks.empty()) {
+        task = std::move(tasks.back());
+        tasks.pop_back();
+      }
+    }
+    // Steal the oldest task of another worker, the biggest piece of work
+    // it has left for later.
+    for (size_t i = 1; !task && i < workers_.size(); ++i) {
+      Worker* worker = workers_[(index + i) % workers_.size()].get();
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      std::deque<std::shared_ptr<Task> >& tasks = worker->tasks[priority];
+      if (!tasks.empty()) {
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+    }
+    if (task) {
+      --queued_;
+      return task;
+    }
+  }
+  return task;
+}
+
+void TaskScheduler::Execute(Task* task) {
+  task->started_at_ = Task::Clock::now();
+  bool run = !task->IsCancelled();
+  if (run) {
+    task->func_(*task);
+  }
+  task->finished_at_ = Task::Clock::now();
+  // Drop what the function holds, as snapshots, right away.
+  task->func_ = nullptr;
+
+  if (run) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    TaskStats& stats = stats_[task->name()];
+    int64_t run_time = task->GetRunTime();
+    stats.name = task->name();
+    ++stats.count;
+    stats.run_time += run_time;
+    stats.max_run_time = std::max(stats.max_run_time, run_time);
+    stats.queued_time += task->GetQueuedTime();
+  }
+  task->Finish();
+}
+
+}  // namespace csi_training
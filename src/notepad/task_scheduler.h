@@ -0,0 +1,163 @@
+#ifndef NOTEPAD_NOTEPAD_TASK_SCHEDULER_H_
+#define NOTEPAD_NOTEPAD_TASK_SCHEDULER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "wx/defs.h"
+#include "wx/event.h"
+
+namespace csi_training {
+
+class TaskScheduler;
+
+// The tasks of a priority run before any of a lower one is started.
+enum TaskPriority {
+  // Work the user waits for, as the rows on screen.
+  kTaskPriorityViewport = 0,
+  // Work over the whole file, as lexing the rows after the screen.
+  kTaskPriorityBackground,
+  kTaskPriorityCount
+};
+
+// A function run by a TaskScheduler. The task is its cancellation token: the
+// function checks IsCancelled() now and then and returns early if it is.
+class Task {
+  wxDECLARE_NO_COPY_CLASS(Task);
+
+ public:
+  typedef std::function<void(const Task&)> Func;
+  typedef std::chrono::steady_clock Clock;
+
+  Task(TaskScheduler* scheduler,
+       const char* name,
+       TaskPriority priority,
+       Func func);
+
+  const char* name() const { return name_; }
+  TaskPriority priority() const { return priority_; }
+
+  // Asks the task to stop, it is dropped if it hasn't started yet. Wait()
+  // for it afterwards.
+  void Cancel() { *cancelled_ = true; }
+  bool IsCancelled() const { return *cancelled_; }
+
+  // Waits for the task to finish. A task that hasn't started yet is run on
+  // this thread instead, so a task can wait for the tasks it submitted.
+  void Wait();
+  bool IsDone() const { return state_ == kDone; }
+
+  // Calls func on the UI thread with the CallAfter() of the handler, unless
+  // the task is cancelled by then. The handler must outlive the task.
+  void CallAfter(wxEvtHandler* handler, std::function<void()> func) const;
+
+  // The time the task waited in a queue and the time it ran, in
+  // microseconds. Valid once it is done.
+  int64_t GetQueuedTime() const;
+  int64_t GetRunTime() const;
+
+ private:
+  friend class TaskScheduler;
+
+  enum State {
+    kQueued = 0,
+    kRunning,
+    kDone
+  };
+
+  // Takes the task to run it, returns false if another thread did.
+  bool Claim();
+  void Finish();
+
+  TaskScheduler* scheduler_;
+  const char* name_;
+  TaskPriority priority_;
+  Func func_;
+  // Shared with the calls posted, which may outlive the task.
+  std::shared_ptr<std::atomic<bool> > cancelled_;
+  std::atomic<int> state_;
+  std::mutex done_mutex_;
+  std::condition_variable done_;
+  Clock::time_point queued_at_;
+  Clock::time_point started_at_;
+  Clock::time_point finished_at_;
+};
+
+// The time spent in the tasks of a name.
+struct TaskStats {
+  std::string name;
+  size_t count;
+  // In microseconds.
+  int64_t run_time;
+  int64_t max_run_time;
+  int64_t queued_time;
+};
+
+// Runs tasks on a pool of threads, one per core. Each thread has a deque of
+// tasks per priority: it runs the tasks it submitted itself last in, first
+// out, and when it has none it steals the oldest ones of the other threads,
+// so fork/join work spreads over the cores without a shared queue. Tasks
+// submitted from other threads are dealt to the threads in turn.
+class TaskScheduler {
+  wxDECLARE_NO_COPY_CLASS(TaskScheduler);
+
+ public:
+  // thread_count is 0 for one thread per core.
+  explicit TaskScheduler(int thread_count = 0);
+  // Cancels the tasks that haven't started and waits for the others.
+  ~TaskScheduler();
+
+  int GetThreadCount() const { return static_cast<int>(workers_.size()); }
+
+  // Queues func to run on a worker thread. name is a literal that groups
+  // the time of the task in the stats.
+  std::shared_ptr<Task> Submit(const char* name,
+                               TaskPriority priority,
+                               Task::Func func);
+
+  // Gets the time spent in the tasks finished so far, by name.
+  std::vector<TaskStats> GetStats() const;
+
+ private:
+  friend class Task;
+
+  struct Worker {
+    std::thread thread;
+    std::mutex mutex;
+    std::deque<std::shared_ptr<Task> > tasks[kTaskPriorityCount];
+  };
+
+  void WorkerLoop(size_t index);
+  // Pops a task of the worker, or steals one from another worker.
+  std::shared_ptr<Task> FindTask(size_t index);
+  // Runs the claimed task on this thread, or drops it if it is cancelled.
+  void Execute(Task* task);
+
+ private:
+  std::vector<std::unique_ptr<Worker> > workers_;
+  // The worker the next task submitted from outside goes to.
+  std::atomic<size_t> next_worker_;
+
+  // Idle workers sleep until tasks are queued.
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  std::atomic<size_t> queued_;
+  bool stopping_;
+
+  mutable std::mutex stats_mutex_;
+  std::map<std::string, TaskStats> stats_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_TASK_SCHEDULER_H_
@@ -1,11 +1,30 @@
 #include "notepad/text_buffer.h"
 
-#include "wx/wfstream.h"
+#include <algorithm>
+
+#include "wx/ffile.h"
+#include "wx/filename.h"
+
+#include "notepad/file_saver.h"
+#include "notepad/mapped_text.h"
 
 namespace csi_training {
+
+// Files at least this big are mapped and indexed in the background instead
+// of being read into memory, both are decoded lazily.
+static const wxULongLong kMapFileSize(8 * 1024 * 1024);
+
+const int TextBuffer::kAllRowsAfter;
+
 /////////////////////////////////////////
 
-TextBuffer::TextBuffer() {
+TextBuffer::TextBuffer()
+    : eol_(1, LF)
+    , loading_(false)
+    , changed_first_row_(0)
+    , changed_last_row_(kAllRowsAfter)
+    , version_(0) {
+  TrackRows(0, GetRowCount());
 }
 
 TextBuffer::~TextBuffer() {
@@ -13,30 +32,84 @@ TextBuffer::~TextBuffer() {
 }
 
 void TextBuffer::ClearBuffer() {
-  text_content_.clear();
-
-  ClearActionList(&undo_actions_);
-  ClearActionList(&redo_actions_);
+  int old_rows = GetRowCount();
+  text_content_.Clear();
+  eol_.assign(1, LF);
+  row_lengths_.clear();
+  TrackRows(0, GetRowCount());
+  loading_ = false;
+  AddRowEdit(0, 0, old_rows, GetRowCount());
+
+  edit_log_.Clear();
 }
 int TextBuffer::GetRowCount() const {
-  return text_content_.size();
+  return text_content_.GetLineCount();
 }
 
 
 wxString TextBuffer::GetRowString(size_t row) const {
-  if (row >= 0 && row < text_content_.size()) {
-    return text_content_[row];
-  } else {
-    return wxString("");
-  }
+  TextView line = GetRowView(row);
+  return wxString(line.data(), line.size());
 }
 
 wxString TextBuffer::GetRowDisplayString(size_t row) const {
-  if (row >= 0 && row < text_content_.size()) {
-    return wxString(GetRowString(row), GetRowDisplayCharCount(row));
-  } else {
-    return wxString("");
+  TextView line = GetRowDisplayView(row);
+  return wxString(line.data(), line.size());
+}
+
+TextView TextBuffer::GetRowView(int row) const {
+  if (row < 0 || row >= GetRowCount()) {
+    return TextView();
+  }
+
+  return ViewText(text_content_.GetLineStart(row),
+                  text_content_.GetLineLength(row),
+                  &row_view_buffer_);
+}
+
+TextView TextBuffer::GetRowDisplayView(int row) const {
+  TextView line = GetRowView(row);
+  if (!line.empty() && line.back() == LF) {
+    line.remove_suffix(1);
+    if (!line.empty() && line.back() == CR) {
+      line.remove_suffix(1);
+    }
+  }
+  return line;
+}
+
+TextView TextBuffer::GetRowSlice(int row,
+                                 size_t first,
+                                 size_t len,
+                                 std::wstring* copy) const {
+  if (row < 0 || row >= GetRowCount()) {
+    return TextView();
   }
+  size_t row_start = text_content_.GetLineStart(row);
+  size_t row_len = GetRowDisplayEnd(row) - row_start;
+  first = std::min(first, row_len);
+  return ViewText(row_start + first, std::min(len, row_len - first), copy);
+}
+
+TextView TextBuffer::ViewText(size_t offset,
+                              size_t len,
+                              std::wstring* copy) const {
+  const wxChar* data = nullptr;
+  size_t runs = 0;
+  text_content_.ForEachRun(
+      offset,
+      len,
+      [&data, &runs](const wxChar* run, size_t) {
+        data = run;
+        ++runs;
+      });
+  if (runs <= 1) {
+    return TextView(data, len);
+  }
+
+  copy->clear();
+  text_content_.GetText(offset, len, copy);
+  return TextView(*copy);
 }
 
 void TextBuffer::DoClear() {
@@ -45,121 +118,154 @@ void TextBuffer::DoClear() {
 
 
 void TextBuffer::DoLoadFile(const wxString& file_path) {
+  if (BeginLoadFile(file_path)) {
+    LoadAllLines();
+  }
+}
+
+bool TextBuffer::BeginLoadFile(const wxString& file_path) {
   ClearBuffer();
 
-  wxFileInputStream file_input(file_path);
-  wxTextInputStream text_input_stream(file_input);
+  // UTF-8 text is kept as it is in the file.
+  wxULongLong file_size = wxFileName::GetSize(file_path);
+  bool map = file_size != wxInvalidSize && file_size >= kMapFileSize;
+  std::unique_ptr<MappedText> mapped(new MappedText);
+  if (map ? mapped->Map(file_path) : mapped->Read(file_path)) {
+    text_content_.Reset(std::move(mapped));
+    loading_ = true;
+    if (map) {
+      return true;
+    }
+    LoadAllLines();
+    return false;
+  }
+
+  // UTF-16 and UTF-32 text is converted.
+  wxFFile file(file_path, wxT("rb"));
+  wxString text;
+  if (file.IsOpened() && file.ReadAll(&text)) {
+    text_content_.Reset(text.ToStdWstring());
+    row_lengths_.clear();
+    TrackOriginalRows(0);
+    DetectEol();
+    AddRowEdit(0, 0, 1, GetRowCount());
+  }
+  return false;
+}
+
+void TextBuffer::AppendLoadedLines(const LineIndex& lines, size_t size) {
+  assert(loading_);
 
-  wxString line = text_input_stream.ReadLine();
-  while (!line.IsEmpty()) {
-    text_content_.push_back(line);
-    line = text_input_stream.ReadLine();
+  size_t first_line_feed = text_content_.GetOriginalLineFeeds().size();
+  int last_row = GetRowCount() - 1;
+  UntrackRows(last_row, 1);
+  text_content_.AppendOriginal(lines, size);
+  TrackOriginalRows(first_line_feed);
+  AddRowEdit(last_row, 0, 1, GetRowCount() - last_row);
+
+  if (first_line_feed == 0) {
+    DetectEol();
   }
 }
 
-void TextBuffer::DoSaveFile(const wxString& file_path) {
+void TextBuffer::EndLoadFile() {
+  loading_ = false;
+}
+
+void TextBuffer::LoadAllLines() {
+  const MappedText* mapped = GetMappedText();
+  LineIndex lines;
+  IndexLines(mapped->text(), mapped->text_size(), &lines);
+  AppendLoadedLines(lines, mapped->text_size());
+  EndLoadFile();
+}
+
+const MappedText* TextBuffer::GetMappedText() const {
+  return text_content_.GetMappedOriginal();
+}
+
+void TextBuffer::TrackOriginalRows(size_t first_line_feed) {
+  // The rows are counted from the line feeds found while loading, looking
+  // each row up in the piece table would cost O(n log n).
+  const std::vector<size_t>& line_feeds = text_content_.GetOriginalLineFeeds();
+  size_t row_start = 0;
+  if (first_line_feed > 0) {
+    row_start = line_feeds[first_line_feed - 1] + 1;
+  }
+  for (size_t i = first_line_feed; i < line_feeds.size(); ++i) {
+    ++row_lengths_[line_feeds[i] + 1 - row_start];
+    row_start = line_feeds[i] + 1;
+  }
+  ++row_lengths_[text_content_.GetLength() - row_start];
+}
+
+void TextBuffer::DetectEol() {
+  const std::vector<size_t>& line_feeds = text_content_.GetOriginalLineFeeds();
+  if (!line_feeds.empty() && line_feeds[0] > 0
+      && text_content_.GetCharAt(line_feeds[0] - 1) == CR) {
+    eol_ = L"\r\n";
+  }
+}
+
+bool TextBuffer::DoSaveFile(const wxString& file_path) {
   assert(!file_path.empty());
+  std::shared_ptr<const TextSnapshot> snapshot = TakeSnapshot();
+  return snapshot && SaveSnapshot(*snapshot, file_path);
+}
 
-  FILE* file = wxFopen(file_path, wxT("wb"));
-  if (file != nullptr) {
-    for (auto str : text_content_) {
-      size_t write_size = fwrite(str.c_str(), 1, str.size(), file);
-    }
+std::shared_ptr<const TextSnapshot> TextBuffer::TakeSnapshot() const {
+  if (loading_) {
+    return nullptr;
   }
-  fclose(file);
+  return text_content_.TakeSnapshot();
 }
 
-wxPoint TextBuffer::InsertChar(const wxPoint& point,
-                               wxChar c,
-                               ActionDir dir,
-                               bool is_undo_redo) {
+wxPoint TextBuffer::InsertChar(const wxPoint& point, wxChar c) {
   new_caret_position_ = point;
-  if (c == CR) {
-    new_caret_position_ = InsertEnter(point, c, dir, is_undo_redo);
+  if (loading_) {
+    return new_caret_position_;
+  }
+  if (c == CR || c == LF) {
+    new_caret_position_ = InsertEnter(point);
   } else {
-    new_caret_position_ = InsertRegularChar(point, c, dir, is_undo_redo);
+    new_caret_position_ = InsertRegularChar(point, c);
   }
   return new_caret_position_;
 }
 
-wxPoint TextBuffer::InsertRegularChar(const wxPoint& point,
-                                      wxChar c,
-                                      ActionDir dir,
-                                      bool is_undo_redo) {
+wxPoint TextBuffer::InsertRegularChar(const wxPoint& point, wxChar c) {
   int new_x = point.x;
   int new_y = point.y;
-  bool action_done = false;
 
-  if (text_content_.empty()) {  // add new line
-    if (point.x == 0 && point.y == 0) {
-      text_content_.push_back(wxString(c));
-      action_done = true;
-    }
-  } else {  // edit existed line
-    if (point.y < static_cast<int>(text_content_.size())) {
-      wxString* line = &(text_content_[point.y]);
-      if (line != nullptr && point.x <= static_cast<int>(line->Length())) {
-        line->insert(point.x, 1, c);
-        action_done = true;
-      }
+  if (point.y >= 0 && point.y < GetRowCount()) {
+    if (point.x >= 0 && point.x <= GetRowDisplayCharCount(point.y)) {
+      size_t offset = text_content_.GetLineStart(point.y) + point.x;
+      InsertAt(offset, &c, 1);
+      edit_log_.AddChar(kInsert, offset, c, false);
     }
   }
   new_x++;
 
-  // collect insert action to support undo/redo
-  if (action_done) {
-    bool is_insert = true;
-    if (!is_undo_redo) {
-      AddUndoAction(point, wxPoint(new_x, new_y), c, dir, is_insert);
-    }
-  }
-
   return wxPoint(new_x, new_y);
 }
-wxPoint TextBuffer::InsertEnter(const wxPoint& point,
-                                wxChar c,
-                                ActionDir dir,
-                                bool is_undo_redo) {
-  int new_x = point.x;
-  int new_y = point.y;
-  bool action_done = false;
-  if (c == CR) {  // insert a new line and jump to the new line
-    if (text_content_.empty()) {  // insert c at the first line
-      if (point.x == 0 && point.y == 0) {
-        text_content_.push_back(wxString(c));
-        text_content_.push_back(wxString(L""));
-        action_done = true;
-      }
-    } else {  // split the line to two
-      if (point.y < static_cast<int>(text_content_.size())) {
-        wxString* line = &(text_content_[point.y]);
-        if (line != nullptr && point.x <= static_cast<int>(line->size())) {
-          wxString new_line(*line, point.x, line->size() - point.x);
-          line->erase(point.x);
-          line->Append(&c, 1);
-          text_content_.insert(text_content_.begin() + point.y + 1, new_line);
-          action_done = true;
-        }
-      }
-    }
-    new_x = 0;
-    new_y = point.y + 1;
-  }
 
-  // collect insert action to support undo/redo
-  if (action_done) {
-    bool is_insert = true;
-    if (!is_undo_redo) {
-      AddUndoAction(point, wxPoint(new_x, new_y), c, dir, is_insert);
+wxPoint TextBuffer::InsertEnter(const wxPoint& point) {
+  // insert a new line and jump to the new line
+  if (point.y >= 0 && point.y < GetRowCount()) {  // split the line to two
+    if (point.x >= 0 && point.x <= GetRowDisplayCharCount(point.y)) {
+      size_t offset = text_content_.GetLineStart(point.y) + point.x;
+      InsertAt(offset, eol_.data(), eol_.size());
+      RecordEdit(kInsert, offset, eol_.size());
     }
   }
-  return wxPoint(new_x, new_y);
+  return wxPoint(0, point.y + 1);
 }
 
-wxPoint TextBuffer::DeleteChar(const wxPoint& point,
-                               ActionDir dir,
-                               bool is_undo_redo) {
+wxPoint TextBuffer::DeleteChar(const wxPoint& point, ActionDir dir) {
   new_caret_position_ = point;
+  if (loading_) {
+    return new_caret_position_;
+  }
   int delete_x = point.x;
   if (dir == kForward) {
     delete_x = point.x - 1;
@@ -168,124 +274,289 @@ wxPoint TextBuffer::DeleteChar(const wxPoint& point,
   int delete_y = point.y;
   if (delete_x < 0) {
     delete_y = delete_y - 1;
-    delete_x = GetRowCharCount(delete_y) - 1;
+    delete_x = GetRowDisplayCharCount(delete_y);
   }
 
-  wxChar deleted_char = DeleteCharInRow(delete_y, delete_x, 1);
-  if (deleted_char != L'\0') {
-    bool is_insert = false;
-    if (!is_undo_redo) {
-      AddUndoAction(point, wxPoint(delete_x, delete_y),
-                    deleted_char, dir, is_insert);
-    }
-
+  // Backspace deletes the char before the caret.
+  if (DeleteCharInRow(delete_y, delete_x, dir == kForward)) {
     new_caret_position_ = wxPoint(delete_x, delete_y);
   }
 
   return new_caret_position_;
 }
 
-wxChar TextBuffer::DeleteCharInRow(int row, int pos, int len) {
-  wxChar deleted_char = L'\0';
-  if (row >= 0 && row < GetRowCount()) {
-    wxString* line = &text_content_[row];
-    if (pos >= 0 && pos < GetRowCharCount(row)) {
-      if (line->at(pos) == CR) {
-        int next_row = row + 1;
-        if (next_row < GetRowCount()) {
-          wxString next_line = GetRowString(row + 1);
-          line->append(next_line);
-          text_content_.erase(text_content_.begin() + row + 1);
-        }
-      }
-      deleted_char = line->at(pos);;
-      line->erase(pos, 1);
+bool TextBuffer::DeleteCharInRow(int row, int pos, bool caret_at_end) {
+  if (row < 0 || row >= GetRowCount()) {
+    return false;
+  }
+
+  size_t row_start = text_content_.GetLineStart(row);
+  size_t row_end = row_start + text_content_.GetLineLength(row);
+  size_t display_end = GetRowDisplayEnd(row);
+  if (pos < 0 || row_start + pos >= row_end) {
+    return false;
+  }
+
+  size_t offset = row_start + pos;
+  size_t len = 1;
+  if (offset >= display_end) {  // join the next row
+    offset = display_end;
+    len = row_end - display_end;
+    RecordEdit(kDelete, offset, len, caret_at_end);
+  } else {
+    edit_log_.AddChar(kDelete, offset, text_content_.GetCharAt(offset),
+                      caret_at_end);
+  }
+  DeleteAt(offset, len);
+  return true;
+}
+
+wxPoint TextBuffer::InsertText(const wxPoint& point, TextView text) {
+  new_caret_position_ = point;
+  if (loading_ || text.empty()) {
+    return new_caret_position_;
+  }
+
+  size_t offset = GetOffset(point);
+  InsertAt(offset, text.data(), text.size());
+  RecordEdit(kInsert, offset, text.size());
+
+  new_caret_position_ = GetPoint(offset + text.size());
+  return new_caret_position_;
+}
+
+wxPoint TextBuffer::DeleteRange(const wxPoint& from, const wxPoint& to) {
+  new_caret_position_ = from;
+  if (loading_) {
+    return new_caret_position_;
+  }
+
+  size_t start = GetOffset(from);
+  size_t end = GetOffset(to);
+  if (start > end) {
+    std::swap(start, end);
+  }
+  if (start < end) {
+    RecordEdit(kDelete, start, end - start, true);
+    DeleteAt(start, end - start);
+  }
+
+  new_caret_position_ = GetPoint(start);
+  return new_caret_position_;
+}
+
+void TextBuffer::InsertAt(size_t offset, const wxChar* text, size_t len) {
+  int row = text_content_.GetLineAt(offset);
+  int column = offset - text_content_.GetLineStart(row);
+  int line_feeds = std::count(text, text + len, LF);
+  UntrackRows(row, 1);
+  text_content_.Insert(offset, text, len);
+  TrackRows(row, line_feeds + 1);
+  AddRowEdit(row, column, 1, line_feeds + 1);
+}
+
+void TextBuffer::DeleteAt(size_t offset, size_t len) {
+  int first = text_content_.GetLineAt(offset);
+  int last = text_content_.GetLineAt(offset + len);
+  int column = offset - text_content_.GetLineStart(first);
+  UntrackRows(first, last - first + 1);
+  text_content_.Delete(offset, len);
+  TrackRows(first, 1);
+  AddRowEdit(first, column, last - first + 1, 1);
+}
+
+bool TextBuffer::TakeChangedRows(int* first_row, int* last_row) {
+  if (changed_first_row_ < 0) {
+    return false;
+  }
+  *first_row = changed_first_row_;
+  *last_row = changed_last_row_;
+  changed_first_row_ = -1;
+  row_edits_.clear();
+  return true;
+}
+
+size_t TextBuffer::GetRowVersion(int row) const {
+  size_t version = 0;
+  std::map<int, size_t>::const_iterator it = row_versions_.find(row);
+  if (it != row_versions_.end()) {
+    version = it->second;
+  }
+  it = moved_versions_.upper_bound(row);
+  if (it != moved_versions_.begin()) {
+    version = std::max(version, (--it)->second);
+  }
+  return version;
+}
+
+void TextBuffer::AddRowEdit(int row,
+                            int column,
+                            int old_count,
+                            int new_count) {
+  RowEdit edit = { row, column, old_count, new_count };
+  row_edits_.push_back(edit);
+
+  int first = row;
+  int last = old_count == new_count ? row + new_count - 1 : kAllRowsAfter;
+  ++version_;
+  if (last == kAllRowsAfter) {
+    // The newer version covers the entries from first on.
+    row_versions_.erase(row_versions_.lower_bound(first), row_versions_.end());
+    moved_versions_.erase(moved_versions_.lower_bound(first),
+                          moved_versions_.end());
+    moved_versions_[first] = version_;
+  } else {
+    for (int row = first; row <= last; ++row) {
+      row_versions_[row] = version_;
+    }
+  }
+
+  if (changed_first_row_ < 0) {
+    changed_first_row_ = first;
+    changed_last_row_ = last;
+    return;
+  }
+  // The union, up to the last row if either moved rows.
+  if (last == kAllRowsAfter
+      || (changed_last_row_ != kAllRowsAfter && last > changed_last_row_)) {
+    changed_last_row_ = last;
+  }
+  changed_first_row_ = std::min(changed_first_row_, first);
+}
+
+void TextBuffer::RecordEdit(ActionType type,
+                            size_t offset,
+                            size_t len,
+                            bool caret_at_end) {
+  edit_log_.Add(type, offset, caret_at_end);
+  text_content_.ForEachRun(offset, len, [this](const wxChar* data,
+                                               size_t n) {
+    edit_log_.AppendText(data, n);
+  });
+}
+
+size_t TextBuffer::GetOffset(const wxPoint& point) const {
+  if (point.y < 0) {
+    return 0;
+  }
+  if (point.y >= GetRowCount()) {
+    return text_content_.GetLength();
+  }
+
+  size_t row_start = text_content_.GetLineStart(point.y);
+  size_t row_len = text_content_.GetLineLength(point.y);
+  if (point.y < GetRowCount() - 1) {
+    --row_len;  // the LF
+  }
+  return row_start + std::min(static_cast<size_t>(std::max(point.x, 0)),
+                              row_len);
+}
+
+wxPoint TextBuffer::GetPoint(size_t offset) const {
+  offset = std::min(offset, text_content_.GetLength());
+  size_t row = text_content_.GetLineAt(offset);
+  return wxPoint(offset - text_content_.GetLineStart(row), row);
+}
+
+size_t TextBuffer::GetRowDisplayEnd(int row) const {
+  size_t row_start = text_content_.GetLineStart(row);
+  size_t row_end = row_start + text_content_.GetLineLength(row);
+  // Every row but the last ends with its LF, only a CR is looked for.
+  if (row < GetRowCount() - 1) {
+    row_end--;
+    if (row_end > row_start && text_content_.GetCharAt(row_end - 1) == CR) {
+      row_end--;
     }
   }
-  return deleted_char;
+  return row_end;
 }
 
 int TextBuffer::GetRowDisplayCharCount(int row) const {
-  wxString line = GetRowString(row);
-  int count = line.size();
-  if (count > 0 && line.at(count - 1) == CR) {
-    count--;
+  if (row < 0 || row >= GetRowCount()) {
+    return 0;
   }
-  return count;
+  return GetRowDisplayEnd(row) - text_content_.GetLineStart(row);
 }
 
 int TextBuffer::GetRowCharCount(int row) const {
-  wxString line = GetRowString(row);
-  return line.size();
+  if (row < 0 || row >= GetRowCount()) {
+    return 0;
+  }
+  return text_content_.GetLineLength(row);
 }
 
 int TextBuffer::GetMaxRowCharCount() const {
-  int max_count = GetRowCharCount(0);
-  for (int i = 1; i < GetRowCount(); i++) {
-    if (max_count < GetRowCharCount(i)) {
-      max_count = GetRowCharCount(i);
-    }
+  if (row_lengths_.empty()) {
+    return 0;
   }
-  return max_count;
+  return row_lengths_.rbegin()->first;
 }
 
-void TextBuffer::AddUndoAction(const wxPoint& action_point,
-                               const wxPoint& after_action_point,
-                               wxChar c,
-                               ActionDir dir,
-                               bool is_insert_or_delete) {
-  if (c != L'\0') {
-    TextAction* text_action = nullptr;
-    if (is_insert_or_delete) {
-      text_action = new InsertAction(this, dir, c, action_point,
-                                     after_action_point);
-    } else {
-      text_action = new DeleteAction(this, dir, c, action_point,
-                                     after_action_point);
-    }
+void TextBuffer::TrackRows(int first, int count) {
+  for (int row = first; row < first + count && row < GetRowCount(); ++row) {
+    ++row_lengths_[GetRowCharCount(row)];
+  }
+}
 
-    if (text_action != nullptr) {
-      undo_actions_.push_back(text_action);
-      ClearActionList(&redo_actions_);
+void TextBuffer::UntrackRows(int first, int count) {
+  for (int row = first; row < first + count && row < GetRowCount(); ++row) {
+    std::map<int, int>::iterator it = row_lengths_.find(GetRowCharCount(row));
+    if (it != row_lengths_.end() && --it->second == 0) {
+      row_lengths_.erase(it);
     }
   }
 }
 
+void TextBuffer::BeginUndoGroup() {
+  edit_log_.BeginGroup();
+}
+
+void TextBuffer::EndUndoGroup() {
+  edit_log_.EndGroup();
+}
+
 void TextBuffer::DoUndo() {
-  if (CanUndo()) {
-    TextAction* undo_action = undo_actions_.back();
-    undo_action->Undo();
-    new_caret_position_ = undo_action->action_position();
-    redo_actions_.push_back(undo_action);
-    undo_actions_.pop_back();
+  if (!CanUndo()) {
+    return;
   }
+
+  // The edits are reverted last first, the caret ends where the first one
+  // was done.
+  edit_log_.Undo([this](const EditLog::Edit& edit) {
+    if (edit.type == kInsert) {
+      DeleteAt(edit.offset, edit.length);
+      new_caret_position_ = GetPoint(edit.offset);
+    } else {
+      InsertAt(edit.offset, edit.text, edit.length);
+      new_caret_position_ = GetPoint(edit.caret_at_end
+                                     ? edit.offset + edit.length
+                                     : edit.offset);
+    }
+  });
 }
 
 void TextBuffer::DoRedo() {
-  if (CanRedo()) {
-    TextAction* redo_action = redo_actions_.back();
-    redo_action->Redo();
-    new_caret_position_ = redo_action->after_action_position();
-    undo_actions_.push_back(redo_action);
-    redo_actions_.pop_back();
+  if (!CanRedo()) {
+    return;
   }
+
+  edit_log_.Redo([this](const EditLog::Edit& edit) {
+    if (edit.type == kInsert) {
+      InsertAt(edit.offset, edit.text, edit.length);
+      new_caret_position_ = GetPoint(edit.offset + edit.length);
+    } else {
+      DeleteAt(edit.offset, edit.length);
+      new_caret_position_ = GetPoint(edit.offset);
+    }
+  });
 }
 
 bool TextBuffer::CanUndo() const {
-  return !undo_actions_.empty();
+  return !loading_ && edit_log_.CanUndo();
 }
 
 bool TextBuffer::CanRedo() const {
-  return !redo_actions_.empty();
-}
-
-void TextBuffer::ClearActionList(std::list<TextAction*>* action_list) {
-  if (action_list != nullptr && !action_list->empty()) {
-    for (auto it : *action_list) {
-      delete it;
-    }
-    action_list->clear();
-  }
+  return !loading_ && edit_log_.CanRedo();
 }
 
 }  // namespace csi_training
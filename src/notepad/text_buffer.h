@@ -1,21 +1,29 @@
 #ifndef NOTEPAD_NOTEPAD_TEXT_BUFFER_H_
 #define NOTEPAD_NOTEPAD_TEXT_BUFFER_H_
 
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <vector>
-#include <list>
 
 #include "wx/gdicmn.h"
 #include "wx/txtstrm.h"
 
 #include "notepad/defs.h"
-#include "notepad/text_action.h"
+#include "notepad/edit_log.h"
+#include "notepad/line_indexer.h"
+#include "notepad/piece_table.h"
 
 namespace csi_training {
 
-class TextAction;
-class DeleteAction;
-class InsertAction;
+// Non-owning view of the chars of a row.
+typedef std::basic_string_view<wxChar> TextView;
 
+typedef PieceTable::Snapshot TextSnapshot;
+
+// The rows of the document. Every row but the last one ends with a line
+// break, which is "\n" or "\r\n" and counts as part of the row.
 class TextBuffer{
  public:
   TextBuffer();
@@ -23,70 +31,194 @@ class TextBuffer{
 
   void DoClear();
   void DoLoadFile(const wxString& file_path);
-  void DoSaveFile(const wxString& file_path);
+  // Saves the text on this thread, see FileSaver to save it in the
+  // background. Returns false if it could not be saved.
+  bool DoSaveFile(const wxString& file_path);
+
+  // Takes an immutable version of the text that can be read on another
+  // thread, in O(1), nullptr while loading.
+  std::shared_ptr<const TextSnapshot> TakeSnapshot() const;
+
+  // Starts loading a file. Small files are loaded right away and false is
+  // returned. Big files are only mapped and true is returned, their lines
+  // are then indexed by a FileLoader over GetMappedText() and handed over
+  // with AppendLoadedLines() until EndLoadFile().
+  // The buffer is read only while it is loading.
+  bool BeginLoadFile(const wxString& file_path);
+  void AppendLoadedLines(const LineIndex& lines, size_t size);
+  void EndLoadFile();
+  bool IsLoading() const { return loading_; }
+
+  // Gets the UTF-8 text of the loaded file, nullptr if it is kept as
+  // wxChars.
+  const MappedText* GetMappedText() const;
 
   int GetRowCount() const;
 
-  // gets the char count at the longest row
+  // gets the char count at the longest row, O(1)
   int GetMaxRowCharCount() const;
 
   wxString GetRowString(size_t row) const;
-  // gets the string without "\r"
+  // gets the string without the line break
   wxString GetRowDisplayString(size_t row) const;
 
   int GetRowCharCount(int row) const;
-  // gets the char count without "\r"
+  // gets the char count without the line break
   int GetRowDisplayCharCount(int row) const;
 
-  // if is_undo_redo = false, we should add this action to undo action list.
-  wxPoint InsertChar(const wxPoint& point,
-                     wxChar c,
-                     ActionDir dir,
-                     bool is_undo_redo = false);
+  // Gets the row without copying it when it is stored contiguously. The view
+  // is valid until the buffer is changed or another row is viewed.
+  TextView GetRowView(int row) const;
+  // gets the view without the line break
+  TextView GetRowDisplayView(int row) const;
+  // Gets the chars [first, first + len) of the row without its line break,
+  // clamped to it. Only they are copied, to *copy, if they span several
+  // pieces, so long rows are viewed in slices. The view is valid until the
+  // buffer or *copy is changed.
+  TextView GetRowSlice(int row,
+                       size_t first,
+                       size_t len,
+                       std::wstring* copy) const;
+
+  // Every edit is recorded in the undo log.
+  wxPoint InsertChar(const wxPoint& point, wxChar c);
 
   // handle insert regular char.
   // for example:abc...xyz, 123...789
-  wxPoint InsertRegularChar(const wxPoint& point,
-                            wxChar c,
-                            ActionDir dir,
-                            bool is_undo = false);
+  wxPoint InsertRegularChar(const wxPoint& point, wxChar c);
+
+  // handle insert "enter", the line break inserted is eol_
+  wxPoint InsertEnter(const wxPoint& point);
+
+  wxPoint DeleteChar(const wxPoint& point, ActionDir dir);
 
-  // handle insert "enter"
-  wxPoint InsertEnter(const wxPoint& point,
-                     wxChar c,
-                     ActionDir dir,
-                     bool is_undo_redo = false);
+  // Inserts the text at point in one step, it may span several rows. The
+  // text is inserted as is, its line breaks are not converted to eol_.
+  // Returns the point after it.
+  wxPoint InsertText(const wxPoint& point, TextView text);
 
-  wxPoint DeleteChar(const wxPoint& point,
-                     ActionDir dir,
-                     bool is_undo_redo = false);
+  // Deletes the text between the points in one step, with the line breaks
+  // in between. Returns the point where it started.
+  wxPoint DeleteRange(const wxPoint& from, const wxPoint& to);
+
+  // Gets the offset of the point in the text, x is clamped to the row
+  // before its LF.
+  size_t GetOffset(const wxPoint& point) const;
+  // Gets the point of the offset in the text.
+  wxPoint GetPoint(size_t offset) const;
 
   void ClearBuffer();
 
-  // if is_insert_or_delete = true, means this is insert action,
-  // otherwise it is delete action.
-  void AddUndoAction(const wxPoint& action_point,
-                     const wxPoint& after_action_point,
-                     wxChar c,
-                     ActionDir dir,
-                     bool is_insert_or_delete);
+  // The edits done until the matching EndUndoGroup() are undone and redone
+  // as one step. Chars typed or deleted one after another are grouped into
+  // words anyway.
+  void BeginUndoGroup();
+  void EndUndoGroup();
 
+  // Undoes/redoes the last step, new_caret_position() is where it ends.
   void DoUndo();
   void DoRedo();
   bool CanUndo() const;
   bool CanRedo() const;
-  void ClearActionList(std::list<TextAction*>* action_list);
 
   wxPoint new_caret_position() const { return new_caret_position_; }
 
+  // Gets the rows changed since the last call, [*first_row, *last_row], and
+  // forgets them with the row edits. *last_row is kAllRowsAfter if rows were
+  // inserted or removed, then every row from *first_row on has moved.
+  // Returns false if nothing changed.
+  bool TakeChangedRows(int* first_row, int* last_row);
+
+  // An edit that replaced rows [row, row + old_count) with the rows
+  // [row, row + new_count). The chars of the first row before column were
+  // kept.
+  struct RowEdit {
+    int row;
+    int column;
+    int old_count;
+    int new_count;
+  };
+
+  // Gets the row edits done since TakeChangedRows(), in order.
+  const std::vector<RowEdit>& row_edits() const { return row_edits_; }
+
+  static const int kAllRowsAfter = -1;
+
+  // Gets the version of the row, which changes whenever the row is edited or
+  // moved. What is drawn of a row can be kept until its version changes.
+  size_t GetRowVersion(int row) const;
+
  protected:
-  wxChar DeleteCharInRow(int row, int pos, int len);
+  // Deleting at or after the display end of a row removes its line break and
+  // joins the next row. Returns false if there is nothing to delete.
+  bool DeleteCharInRow(int row, int pos, bool caret_at_end);
+
+  // Inserts/deletes the text at offset, keeping row_lengths_ up to date.
+  // Nothing is recorded in the undo log.
+  void InsertAt(size_t offset, const wxChar* text, size_t len);
+  void DeleteAt(size_t offset, size_t len);
+
+  // Records the edit of the text at [offset, offset + len) in the undo log,
+  // after it is inserted or before it is deleted.
+  void RecordEdit(ActionType type,
+                  size_t offset,
+                  size_t len,
+                  bool caret_at_end = false);
+
+  // Indexes all the lines of the mapped text on this thread and ends
+  // loading.
+  void LoadAllLines();
+
+  // Tracks the rows of the original text ending at its line feeds from
+  // first_line_feed on, and the last row.
+  void TrackOriginalRows(size_t first_line_feed);
+
+  // Follows the line break of the first row of the loaded text.
+  void DetectEol();
+
+  // Gets the offset of the row's line break, or of its end for the last row.
+  size_t GetRowDisplayEnd(int row) const;
+
+  // Adds/removes the char counts of rows [first, first + count) to/from
+  // row_lengths_. Edits untrack the rows they touch before changing them and
+  // track them again afterwards.
+  void TrackRows(int first, int count);
+  void UntrackRows(int first, int count);
+
+  // Records that rows [row, row + old_count) were replaced by
+  // [row, row + new_count) from column on: adds them to the changed rows and
+  // the row edits and bumps their version.
+  void AddRowEdit(int row, int column, int old_count, int new_count);
+
+  // Views the chars [offset, offset + len), copying them to *copy if they
+  // span several pieces.
+  TextView ViewText(size_t offset, size_t len, std::wstring* copy) const;
 
  private:
   wxPoint new_caret_position_;
-  std::vector<wxString> text_content_;
-  std::list<TextAction*> undo_actions_;
-  std::list<TextAction*> redo_actions_;
+  PieceTable text_content_;
+  // Line break inserted by "enter", follows the loaded file.
+  std::wstring eol_;
+  // Histogram of row char counts: char count -> number of rows.
+  std::map<int, int> row_lengths_;
+  bool loading_;
+  // Holds the viewed row when it spans several pieces.
+  mutable std::wstring row_view_buffer_;
+  EditLog edit_log_;
+  // The rows changed since TakeChangedRows(), none if changed_first_row_ is
+  // -1.
+  int changed_first_row_;
+  int changed_last_row_;
+  std::vector<RowEdit> row_edits_;
+
+  // Bumped for every change, the version of a row is the one of its last
+  // change: the greatest of its entry in row_versions_, if any, and of the
+  // entry in moved_versions_ at or before it.
+  size_t version_;
+  // Rows edited in place -> version.
+  std::map<int, size_t> row_versions_;
+  // First row moved -> version, for the rows from it on.
+  std::map<int, size_t> moved_versions_;
 };
 
 }  // namespace csi_training
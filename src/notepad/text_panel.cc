@@ -1,15 +1,67 @@
 #include "notepad/text_panel.h"
 
+#include <algorithm>
+
 #include "wx/caret.h"
 #include "wx/dc.h"
 #include "wx/dcbuffer.h"
+#include "wx/dcmemory.h"
 #include "wx/log.h"
 #include "wx/sizer.h"
 
 #include "notepad/defs.h"
+#include "notepad/lexer.h"
 #include "notepad/text_buffer.h"
 
 namespace csi_training {
+
+// Rows shorter than this are drawn whole, finding the columns in the update
+// region would cost more than letting the DC clip them.
+static const size_t kMinClippedLineLength = 256;
+
+// Memory kept for the bitmaps of the rows drawn, a few screens.
+static const size_t kMaxLineTileBytes = 32 * 1024 * 1024;
+
+// Keys are applied at most once per frame, at about 60 frames a second.
+static const int kFrameInterval = 16;
+
+// Stale rows laid out per idle event while wrapping, a few milliseconds.
+static const int kMaxRowsLaidOutAtOnce = 4096;
+
+// Rows at least this long are wrapped every so many chars rather than at
+// spaces, so laying them out doesn't measure megabytes.
+static const size_t kMinCharWrappedLength = 64 * 1024;
+
+static bool IsLowSurrogate(wxChar c) {
+  return c >= 0xDC00 && c <= 0xDFFF;
+}
+
+// The colour of the chars of a kind of token.
+static wxColour GetTokenColour(TokenKind kind) {
+  switch (kind) {
+    case kTokenComment:
+      return wxColour(0x00, 0x80, 0x00);
+    case kTokenString:
+      return wxColour(0xA3, 0x15, 0x15);
+    case kTokenNumber:
+      return wxColour(0x09, 0x86, 0x58);
+    case kTokenKeyword:
+      return wxColour(0x00, 0x00, 0xFF);
+    case kTokenPreprocessor:
+      return wxColour(0x80, 0x40, 0x00);
+    case kTokenSection:
+      return wxColour(0x80, 0x00, 0x80);
+    case kTokenKey:
+      return wxColour(0x00, 0x50, 0xA0);
+    case kTokenError:
+      return wxColour(0xD0, 0x00, 0x00);
+    case kTokenWarning:
+      return wxColour(0xC0, 0x80, 0x00);
+    default:
+      return wxSystemSettings::GetColour(wxSYS_COLOUR_GRAYTEXT);
+  }
+}
+
 /////////////////////////////////////////
 
 BEGIN_EVENT_TABLE(TextPanel, wxScrolledWindow)
@@ -22,9 +74,15 @@ EVT_MOUSE_CAPTURE_LOST(TextPanel::OnMouseCaptureLost)
 EVT_KEY_DOWN(TextPanel::OnKeyDown)
 EVT_CHAR(TextPanel::OnChar)
 EVT_SCROLLWIN(TextPanel::OnScroll)
+EVT_THREAD(ID_Loader_Lines, TextPanel::OnLoaderLines)
+EVT_THREAD(ID_Loader_Done, TextPanel::OnLoaderDone)
+EVT_TIMER(ID_Frame_Timer, TextPanel::OnFrameTimer)
+EVT_IDLE(TextPanel::OnIdle)
+EVT_THREAD(ID_Highlighter_States, TextPanel::OnHighlighterStates)
 END_EVENT_TABLE();
 
 TextPanel::TextPanel(TextBuffer* buffer,
+                     TaskScheduler* scheduler,
                      wxWindow *parent,
                      wxWindowID winid,
                      const wxPoint& pos,
@@ -33,12 +91,28 @@ TextPanel::TextPanel(TextBuffer* buffer,
                      const wxString& name)
     : wxScrolledWindow(parent, winid, pos, size, style, name)
     , text_buffer_(buffer)
+    , scheduler_(scheduler)
+    , line_widths_(&char_widths_, buffer)
+    , line_tiles_(kMaxLineTileBytes)
+    , highlighter_(this, scheduler)
+    , wrap_(false)
+    , wrap_width_(0)
+    , layout_changed_(false)
     , line_height_(0)
-    , line_padding_(0) {
+    , line_padding_(0)
+    , file_loader_(nullptr)
+    , load_id_(0)
+    , damaged_first_row_(-1)
+    , damaged_last_row_(-1)
+    , pending_scroll_(-1, -1)
+    , scroll_pending_(false)
+    , frame_timer_(this, ID_Frame_Timer) {
   Init();
 }
 
 TextPanel::~TextPanel() {
+  StopLoader();
+  highlighter_.StopWorker();
 }
 
 void TextPanel::Init() {
@@ -52,6 +126,7 @@ void TextPanel::Init() {
   dc.GetTextExtent(wxString("a"), &cw, &ch, 0, nullptr);
 
   char_size_.Set(cw, ch);
+  char_widths_.SetFont(GetFont());
 
   wxCaret* caret = new wxCaret(this, 1, ch);
   SetCaret(caret);
@@ -68,61 +143,353 @@ void TextPanel::Init() {
 
 void TextPanel::Clear() {
   assert(text_buffer_ != nullptr);
+  StopLoader();
+  pending_keys_.clear();
   text_buffer_->DoClear();
+  RefreshChangedRows();
+  highlighter_.SetLexer(nullptr, *text_buffer_);
 
   click_position_.x = 0;
   click_position_.y = 0;
   UpdateCaretPosition();
-  Refresh();
 }
 
 void TextPanel::LoadFile(const wxString& file) {
   assert(text_buffer_ != nullptr);
-  text_buffer_->DoLoadFile(file);
+  StopLoader();
+  pending_keys_.clear();
+
+  click_position_ = wxPoint(0, 0);
+  if (text_buffer_->BeginLoadFile(file)) {
+    const MappedText* mapped = text_buffer_->GetMappedText();
+    file_loader_ = new FileLoader(this,
+                                  scheduler_,
+                                  mapped->text(),
+                                  mapped->text_size(),
+                                  ++load_id_);
+    file_loader_->Start();
+  }
+  RefreshChangedRows();
+  // Rows loaded later are added to the highlighter as they arrive.
+  highlighter_.SetLexer(CreateLexer(file), *text_buffer_);
+  RefreshChangedStates();
+
   UpdateVirtualSize();
-  Refresh();
+  UpdateCaretPosition();
+}
+
+bool TextPanel::IsLoading() const {
+  return text_buffer_->IsLoading();
+}
+
+void TextPanel::CancelLoad() {
+  if (IsLoading()) {
+    Clear();
+    UpdateVirtualSize();
+  }
 }
 
-void TextPanel::SaveFile(const wxString& file) {
+void TextPanel::StopLoader() {
+  if (file_loader_ != nullptr) {
+    file_loader_->Cancel();
+    file_loader_->Wait();
+    delete file_loader_;
+    file_loader_ = nullptr;
+  }
+  // Ignore the events the stopped loader has already posted.
+  ++load_id_;
+}
+
+void TextPanel::OnLoaderLines(wxThreadEvent& evt) {
+  if (evt.GetInt() != load_id_ || !text_buffer_->IsLoading()) {
+    return;
+  }
+
+  std::shared_ptr<LoadedLines> loaded =
+      evt.GetPayload<std::shared_ptr<LoadedLines> >();
+  text_buffer_->AppendLoadedLines(loaded->lines, loaded->size);
+  RefreshChangedRows();
+  UpdateVirtualSize();
+}
+
+void TextPanel::OnLoaderDone(wxThreadEvent& evt) {
+  if (evt.GetInt() != load_id_) {
+    return;
+  }
+
+  file_loader_->Wait();
+  delete file_loader_;
+  file_loader_ = nullptr;
+  text_buffer_->EndLoadFile();
+  highlighter_.LexInBackground(*text_buffer_);
+}
+
+void TextPanel::OnHighlighterStates(wxThreadEvent& evt) {
+  highlighter_.OnLexedStates(evt, *text_buffer_);
+  RefreshChangedStates();
+}
+
+std::shared_ptr<const TextSnapshot> TextPanel::TakeSnapshot() {
   assert(text_buffer_ != nullptr);
-  text_buffer_->DoSaveFile(file);
-  Refresh();
+  ApplyPendingKeys();
+  return text_buffer_->TakeSnapshot();
 }
 
 void TextPanel::OnPaint(wxPaintEvent& evt) {
   wxLogDebug("TextPanel::OnPaint");
 
   wxAutoBufferedPaintDC dc(this);
+  PrepareDC(dc);
+
+  // The update region is in client coordinates.
+  wxRect rect = GetUpdateRegion().GetBox();
+  rect.SetPosition(CalcUnscrolledPosition(rect.GetPosition()));
+  Paint(dc, rect);
+}
+
+void TextPanel::Paint(wxDC& dc, const wxRect& rect) {
+  // Only rect is cleared, after a scroll it is the strip exposed.
+  wxColour background = wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOW);
+  dc.SetPen(wxPen(background));
+  dc.SetBrush(wxBrush(background));
+  dc.DrawRectangle(rect);
+
+  dc.SetFont(GetFont());
+  if (wrap_) {
+    PaintWrapped(dc, rect);
+    return;
+  }
+
+  // Only the rows in rect are drawn, so painting costs the same for any
+  // document size.
+  int first_row = std::max(rect.GetTop() / line_height_, 0);
+  int last_row = std::min(rect.GetBottom() / line_height_,
+                          text_buffer_->GetRowCount() - 1);
+  // The rows drawn are lexed first, the ones after them in the background.
+  highlighter_.LexRows(*text_buffer_, last_row);
+  RefreshChangedStates();
+  highlighter_.LexInBackground(*text_buffer_);
+
+  for (int row = first_row; row <= last_row; ++row) {
+    size_t len = static_cast<size_t>(
+        text_buffer_->GetRowDisplayCharCount(row));
+    if (len == 0) {
+      continue;
+    }
+    if (len < kMinClippedLineLength) {
+      // Rows drawn before are blitted, unless they changed since.
+      TextView line = text_buffer_->GetRowDisplayView(row);
+      dc.DrawBitmap(GetLineTile(row, line), 0, row * line_height_);
+      continue;
+    }
+
+    // Only the columns in rect, with a char more on both sides.
+    size_t first = line_widths_.GetColumn(row, rect.GetLeft());
+    size_t last = line_widths_.GetColumn(row, rect.GetRight());
+    first = first > 0 ? first - 1 : 0;
+    last = std::min(last + 2, len);
+    int x = line_widths_.GetX(row, first);
+    if (len > Highlighter::kMaxLexedRowLength) {
+      // Rows too long to lex are drawn plain, from a slice of them.
+      TextView slice = text_buffer_->GetRowSlice(row, first, last - first,
+                                                 &slice_text_);
+      DrawLine(dc, row, slice, first, first, last, x, row * line_height_);
+    } else {
+      TextView line = text_buffer_->GetRowDisplayView(row);
+      DrawLine(dc, row, line, 0, first, last, x, row * line_height_);
+    }
+  }
+}
+
+void TextPanel::PaintWrapped(wxDC& dc, const wxRect& rect) {
+  // The rows are laid out before any is drawn, laying out one moves the
+  // rows after it.
+  int first_line = std::max(rect.GetTop() / line_height_, 0);
+  int last_line = rect.GetBottom() / line_height_;
+  LayOutLines(first_line, last_line);
+
+  int line_top = 0;
+  int first_row = wrap_layout_.GetRowAt(first_line, &line_top);
+  int last_row = wrap_layout_.GetRowAt(last_line, &line_top);
+  highlighter_.LexRows(*text_buffer_, last_row);
+  RefreshChangedStates();
+  highlighter_.LexInBackground(*text_buffer_);
+
+  std::vector<size_t> starts;
+  for (int row = first_row; row <= last_row; ++row) {
+    size_t len = static_cast<size_t>(
+        text_buffer_->GetRowDisplayCharCount(row));
+    if (len == 0) {
+      continue;
+    }
+    int top = GetRowTop(row);
+    if (len < kMinClippedLineLength) {
+      TextView line = text_buffer_->GetRowDisplayView(row);
+      dc.DrawBitmap(GetLineTile(row, line), 0, top);
+      continue;
+    }
+
+    if (len >= kMinCharWrappedLength) {
+      // Only the lines in rect, each from a slice of the row.
+      size_t columns = GetWrapColumns();
+      size_t first = static_cast<size_t>(
+          std::max((rect.GetTop() - top) / line_height_, 0));
+      size_t last = static_cast<size_t>(
+          std::max((rect.GetBottom() - top) / line_height_, 0));
+      for (size_t i = first; i <= last && i * columns < len; ++i) {
+        size_t start = i * columns;
+        size_t end = std::min(start + columns, len);
+        TextView slice = text_buffer_->GetRowSlice(row, start, end - start,
+                                                   &slice_text_);
+        DrawLine(dc, row, slice, start, start, end, 0,
+                 top + static_cast<int>(i) * line_height_);
+      }
+      continue;
+    }
+
+    // Only the lines in rect, each is at most as wide as the window.
+    TextView line = text_buffer_->GetRowDisplayView(row);
+    GetWrapStarts(row, line, &starts);
+    for (size_t i = 0; i < starts.size(); ++i) {
+      int y = top + static_cast<int>(i) * line_height_;
+      if (y + line_height_ <= rect.GetTop() || y > rect.GetBottom()) {
+        continue;
+      }
+      size_t end = i + 1 < starts.size() ? starts[i + 1] : line.size();
+      DrawLine(dc, row, line, 0, starts[i], end, 0, y);
+    }
+  }
+}
+
+wxBitmap TextPanel::GetLineTile(int row, TextView line) {
+  size_t version = text_buffer_->GetRowVersion(row);
+  // Rows are drawn again when the state they start in changes.
+  int style = -1;
+  highlighter_.GetRowState(row, &style);
+  const wxBitmap* tile = line_tiles_.Get(row, version, style);
+  if (tile != nullptr) {
+    return *tile;
+  }
+
+  // A wrapped row is drawn in several lines.
+  std::vector<size_t> starts(1, 0);
+  if (wrap_) {
+    GetWrapStarts(row, line, &starts);
+  }
+  starts.push_back(line.size());
+  int width = 0;
+  for (size_t i = 0; i + 1 < starts.size(); ++i) {
+    width = std::max(width,
+                     line_widths_.GetX(row, starts[i + 1])
+                     - line_widths_.GetX(row, starts[i]));
+  }
+  int lines = static_cast<int>(starts.size()) - 1;
+  wxBitmap bitmap(std::max(width, 1), line_height_ * lines);
+  wxMemoryDC dc(bitmap);
   dc.SetBackground(wxBrush(wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOW)));
   dc.Clear();
-
-  dc.SetTextForeground(wxSystemSettings::GetColour(wxSYS_COLOUR_GRAYTEXT));
   dc.SetFont(GetFont());
+  for (int i = 0; i < lines; ++i) {
+    DrawLine(dc, row, line, 0, starts[i], starts[i + 1], 0,
+             i * line_height_);
+  }
+  dc.SelectObject(wxNullBitmap);
 
-  PrepareDC(dc);
+  line_tiles_.Add(row, version, style, bitmap);
+  return bitmap;
+}
 
-  wxRect rect = GetClientRect();
-  int x = rect.x;
-  int y = rect.y;
+void TextPanel::DrawLine(wxDC& dc,
+                         int row,
+                         TextView line,
+                         size_t line_start,
+                         size_t first,
+                         size_t last,
+                         int x,
+                         int y) {
+  // Only whole rows are lexed, the runs are kept for the row and reused
+  // for the other lines of it.
+  size_t len = static_cast<size_t>(text_buffer_->GetRowDisplayCharCount(row));
+  int state = 0;
+  if (line_start > 0 || line.size() < len
+      || len > Highlighter::kMaxLexedRowLength
+      || !highlighter_.GetRowState(row, &state)) {
+    dc.SetTextForeground(wxSystemSettings::GetColour(wxSYS_COLOUR_GRAYTEXT));
+    paint_text_.assign(line.data() + (first - line_start), last - first);
+    dc.DrawText(paint_text_, x, y);
+    return;
+  }
 
-  for (int i = 0; i < text_buffer_->GetRowCount(); ++i) {
-    dc.DrawText(
-      text_buffer_->GetRowString(i),
-      x,
-      y);
-    y += line_height_;
+  size_t version = text_buffer_->GetRowVersion(row);
+  const std::vector<TokenRun>& runs =
+      highlighter_.GetRuns(row, version, state, line);
+  int left = line_widths_.GetX(row, first) - x;
+  for (size_t i = 0; i < runs.size(); ++i) {
+    size_t start = std::max(static_cast<size_t>(runs[i].start), first);
+    size_t end = i + 1 < runs.size()
+        ? std::min(static_cast<size_t>(runs[i + 1].start), last) : last;
+    if (start >= end) {
+      continue;
+    }
+    int run_x = line_widths_.GetX(row, start);
+    dc.SetTextForeground(GetTokenColour(runs[i].kind));
+    paint_text_.assign(line.data() + start, end - start);
+    dc.DrawText(paint_text_, run_x - left, y);
   }
 }
 
 void TextPanel::OnSize(wxSizeEvent& evt) {
   wxLogDebug("TextPanel::OnSize");
+  if (wrap_ && GetWrapWidth() != wrap_width_) {
+    // The rows are laid out again, those shown now and the others when
+    // idle. The row at the top stays there.
+    int top_row = GetRowAtY(GetViewStart().y * line_height_);
+    wrap_width_ = GetWrapWidth();
+    wrap_layout_.Invalidate();
+    line_tiles_.Clear();
+    RefreshRows(0, TextBuffer::kAllRowsAfter);
+    UpdateVirtualSize();
+    Scroll(0, GetRowTop(top_row) / line_height_);
+  }
   UpdateVirtualSize();
   UpdateCaretPosition();
   evt.Skip();
 }
 
 void TextPanel::OnScroll(wxScrollWinEvent& event) {
-  event.Skip();
+  if (event.GetEventType() != wxEVT_SCROLLWIN_THUMBTRACK) {
+    // wxScrolledWindow scrolls with ScrollWindow().
+    event.Skip();
+    return;
+  }
+
+  // A drag scrolls to its last position once the events queued so far are
+  // handled, the positions in between are never painted.
+  if (event.GetOrientation() == wxHORIZONTAL) {
+    pending_scroll_.x = event.GetPosition();
+  } else {
+    pending_scroll_.y = event.GetPosition();
+  }
+  if (!scroll_pending_) {
+    scroll_pending_ = true;
+    CallAfter(&TextPanel::ScrollToPending);
+  }
+}
+
+void TextPanel::ScrollToPending() {
+  scroll_pending_ = false;
+  // -1 keeps the position.
+  Scroll(pending_scroll_);
+  pending_scroll_ = wxPoint(-1, -1);
+}
+
+void TextPanel::ScrollWindow(int dx, int dy, const wxRect* rect) {
+  // The pixels kept are moved, only the rows and columns exposed are
+  // painted.
+  wxScrolledWindow::ScrollWindow(dx, dy, rect);
+  // The caret stays at its client position, move it back to its char. The
+  // point is clamped, undo may have removed its row before it scrolled.
+  UpdateCaretPoint(click_position_);
 }
 
 void TextPanel::OnMouseEvents(wxMouseEvent& evt) {
@@ -145,7 +512,6 @@ void TextPanel::OnMouseEvents(wxMouseEvent& evt) {
   } else if (evt_type == wxEVT_LEFT_DCLICK) {
     DoMouseLeftDClick(evt);
   }
-  Refresh();
   evt.Skip();
 }
 
@@ -166,9 +532,7 @@ void TextPanel::OnChar(wxKeyEvent& evt) {
 
   wxChar c = evt.GetUnicodeKey();
   if (c >= 0x20) {  // "< 0x20" is CONTROL
-    InsertChar(c);
-    UpdateVirtualSize();
-    Refresh();
+    QueueKey(WXK_NONE, c);
   }
 }
 
@@ -212,51 +576,96 @@ bool TextPanel::HandleSpecialKeyDown(wxKeyEvent& evt) {
 
   if (code == WXK_TAB && modifiers == 0) {
     // Input a space instead of tab.
-    InsertChar(kSpaceChar);
+    QueueKey(WXK_NONE, kSpaceChar);
     return true;
   }
 
   if (code == WXK_RETURN && modifiers == 0) {
-    wxChar c = evt.GetUnicodeKey();
-    InsertChar(c);
+    QueueKey(WXK_NONE, evt.GetUnicodeKey());
     return true;
   }
 
-  if (code == WXK_BACK && modifiers == 0) {
-    DeleteChar(kForward);
+  if ((code == WXK_BACK
+       || code == WXK_DELETE
+       || code == WXK_UP
+       || code == WXK_DOWN
+       || code == WXK_LEFT
+       || code == WXK_RIGHT) && modifiers == 0) {
+    QueueKey(code, 0);
     return true;
   }
 
-  if (code == WXK_DELETE && modifiers == 0) {
-    DeleteChar(kBackward);
-    return true;
-  }
+  return false;
+}
 
-  if (code == WXK_UP && modifiers == 0) {
-    click_position_.y -= 1;
-    UpdateCaretPoint(click_position_);
-    return true;
+void TextPanel::QueueKey(int code, wxChar c) {
+  if (pending_keys_.empty()) {
+    frame_watch_.Start();
+    frame_timer_.StartOnce(kFrameInterval);
   }
+  PendingKey key = { code, c };
+  pending_keys_.push_back(key);
 
-  if (code == WXK_DOWN && modifiers == 0) {
-    click_position_.y += 1;
-    UpdateCaretPoint(click_position_);
-      return true;
+  // Timer events may wait behind a flood of key events, the frame is due
+  // anyway.
+  if (frame_watch_.Time() >= kFrameInterval) {
+    ApplyPendingKeys();
   }
+}
 
-  if (code == WXK_LEFT && modifiers == 0) {
-    click_position_.x -= 1;
-    UpdateCaretPoint(click_position_);
-    return true;
+void TextPanel::OnFrameTimer(wxTimerEvent& evt) {
+  ApplyPendingKeys();
+}
+
+void TextPanel::ApplyPendingKeys() {
+  if (pending_keys_.empty()) {
+    return;
   }
+  frame_timer_.Stop();
 
-  if (code == WXK_RIGHT && modifiers == 0) {
-    click_position_.x += 1;
-    UpdateCaretPoint(click_position_);
-    return true;
+  for (const PendingKey& key : pending_keys_) {
+    ApplyKey(key);
   }
+  pending_keys_.clear();
 
-  return false;
+  // Once for all the keys.
+  RefreshChangedRows();
+  UpdateVirtualSize();
+  UpdateCaretPosition();
+}
+
+void TextPanel::ApplyKey(const PendingKey& key) {
+  switch (key.code) {
+    case WXK_NONE:
+      InsertChar(key.c);
+      break;
+    case WXK_BACK:
+      DeleteChar(kForward);
+      break;
+    case WXK_DELETE:
+      DeleteChar(kBackward);
+      break;
+    case WXK_UP:
+      if (wrap_) {
+        MoveCaretLines(-1);
+      } else {
+        SetCaretPoint(wxPoint(click_position_.x, click_position_.y - 1));
+      }
+      break;
+    case WXK_DOWN:
+      if (wrap_) {
+        MoveCaretLines(1);
+      } else {
+        SetCaretPoint(wxPoint(click_position_.x, click_position_.y + 1));
+      }
+      break;
+    case WXK_LEFT:
+      SetCaretPoint(wxPoint(click_position_.x - 1, click_position_.y));
+      break;
+    case WXK_RIGHT:
+      SetCaretPoint(wxPoint(click_position_.x + 1, click_position_.y));
+      break;
+  }
 }
 
 void TextPanel::DoMouseLeftDown(wxMouseEvent& evt) {
@@ -267,6 +676,8 @@ void TextPanel::DoMouseLeftDown(wxMouseEvent& evt) {
     CaptureMouse();
   }
 
+  // The keys typed before the click go where the caret was.
+  ApplyPendingKeys();
   click_position_ = CalcCaretPoint(evt.GetPosition());
 
   HandleLeftDownNoAccel();
@@ -329,7 +740,114 @@ void TextPanel::HandleLeftDownNoAccel() {
   UpdateCaretPoint(click_position_);
 }
 
+void TextPanel::RefreshChangedRows() {
+  int first_row = 0;
+  int last_row = 0;
+  // The highlighter and the layout follow the rows before the edits are
+  // forgotten.
+  highlighter_.ApplyRowEdits(text_buffer_->row_edits());
+  if (wrap_ && !text_buffer_->row_edits().empty()) {
+    for (const TextBuffer::RowEdit& edit : text_buffer_->row_edits()) {
+      wrap_layout_.ApplyRowEdit(edit.row, edit.old_count, edit.new_count);
+    }
+    layout_changed_ = true;
+  }
+  // A row edited in place is measured again only from the edit on.
+  for (const TextBuffer::RowEdit& edit : text_buffer_->row_edits()) {
+    if (edit.old_count == 1 && edit.new_count == 1) {
+      line_widths_.InvalidateFrom(edit.row, edit.column);
+    } else if (edit.old_count == edit.new_count) {
+      line_widths_.Invalidate(edit.row, edit.row + edit.new_count - 1);
+    } else {
+      line_widths_.Invalidate(edit.row, TextBuffer::kAllRowsAfter);
+    }
+  }
+  if (!text_buffer_->TakeChangedRows(&first_row, &last_row)) {
+    return;
+  }
+  RefreshRows(first_row, last_row);
+
+  // The rows shown after the edited ones are repainted in the same frame if
+  // the edits change their colours.
+  highlighter_.LexRows(*text_buffer_, GetLastVisibleRow());
+  RefreshChangedStates();
+}
+
+void TextPanel::RefreshChangedStates() {
+  int first_row = 0;
+  int last_row = 0;
+  if (highlighter_.TakeChangedStates(&first_row, &last_row)) {
+    RefreshRows(first_row, last_row);
+  }
+}
+
+int TextPanel::GetLastVisibleRow() const {
+  int client_width = 0;
+  int client_height = 0;
+  GetClientSize(&client_width, &client_height);
+  int x = 0;
+  int bottom = 0;
+  CalcUnscrolledPosition(0, client_height, &x, &bottom);
+  return GetRowAtY(bottom);
+}
+
+void TextPanel::RefreshRows(int first_row, int last_row) {
+  if (damaged_first_row_ < 0) {
+    // The damage of the whole event is repainted at once.
+    CallAfter(&TextPanel::RefreshDamage);
+    damaged_first_row_ = first_row;
+    damaged_last_row_ = last_row;
+    return;
+  }
+  if (last_row == TextBuffer::kAllRowsAfter
+      || (damaged_last_row_ != TextBuffer::kAllRowsAfter
+          && last_row > damaged_last_row_)) {
+    damaged_last_row_ = last_row;
+  }
+  damaged_first_row_ = std::min(damaged_first_row_, first_row);
+}
+
+void TextPanel::RefreshDamage() {
+  if (layout_changed_) {
+    UpdateVirtualSize();
+  }
+  if (damaged_first_row_ < 0) {
+    return;
+  }
+  int client_width = 0;
+  int client_height = 0;
+  GetClientSize(&client_width, &client_height);
+
+  // The rows are mapped to the window now, it may have scrolled since.
+  int x = 0;
+  int top = 0;
+  CalcScrolledPosition(0, GetRowTop(damaged_first_row_), &x, &top);
+  int bottom = client_height;
+  if (damaged_last_row_ != TextBuffer::kAllRowsAfter) {
+    CalcScrolledPosition(0, GetRowTop(damaged_last_row_ + 1), &x, &bottom);
+    bottom = std::min(bottom, client_height);
+  }
+  top = std::max(top, 0);
+  damaged_first_row_ = -1;
+
+  if (top < bottom) {
+    RefreshRect(wxRect(0, top, client_width, bottom - top));
+  }
+}
+
 void TextPanel::UpdateVirtualSize() {
+  if (wrap_) {
+    // As wide as the window, as high as the lines.
+    LayOutVisibleLines();
+    int client_width = 0;
+    int client_height = 0;
+    GetClientSize(&client_width, &client_height);
+    int vh = (wrap_layout_.GetLineCount() + 1) * line_height_;
+    layout_changed_ = false;
+    SetVirtualSize(client_width, vh);
+    AdjustScrollbars();
+    return;
+  }
   int vw = text_buffer_->GetMaxRowCharCount()*char_size_.x + char_size_.x;
   int vh = text_buffer_->GetRowCount()*line_height_ + line_height_;
   SetVirtualSize(vw, vh);
@@ -341,22 +859,21 @@ void TextPanel::DoShowScrollbar() {
 }
 
 void TextPanel::UpdateCaretPosition() {
-  int x_off = 0;
-  int y = click_position_.y;
-
-  int caret_x = GetLineWidth(text_buffer_->GetRowDisplayString(y),
-                             x_off,
-                             click_position_.x);
-  int caret_y = y * line_height_;
+  int caret_x = 0;
+  int caret_y = GetPointLine(click_position_, &caret_x) * line_height_;
 
   wxPoint p;
   CalcScrolledPosition(caret_x, caret_y, &p.x, &p.y);
 
   GetCaret()->Move(p);
-  Refresh();
 }
 
 void TextPanel::UpdateCaretPoint(const wxPoint& point) {
+  SetCaretPoint(point);
+  UpdateCaretPosition();
+}
+
+void TextPanel::SetCaretPoint(const wxPoint& point) {
   wxPoint p(point);
 
   if (p.y >= text_buffer_->GetRowCount())
@@ -375,8 +892,6 @@ void TextPanel::UpdateCaretPoint(const wxPoint& point) {
     p.x = 0;
 
   click_position_ = p;
-
-  UpdateCaretPosition();
 }
 
 wxPoint TextPanel::CalcCaretPoint(const wxPoint& pos) {
@@ -390,6 +905,10 @@ wxPoint TextPanel::CalcCaretPoint(const wxPoint& pos) {
 
   // Calculate unscrolled position.
   wxPoint unscrolled_pos = CalcUnscrolledPosition(adjusted_pos);
+  if (wrap_) {
+    return GetLinePoint(std::max(unscrolled_pos.y / line_height_, 0),
+                        unscrolled_pos.x);
+  }
 
   // Calculate caret point from text buffer.
   wxPoint caret_point = unscrolled_pos;
@@ -409,79 +928,323 @@ wxPoint TextPanel::CalcCaretPoint(const wxPoint& pos) {
 }
 
 int TextPanel::GetCharIndex(int ln, int client_x) const {
-  return IndexChar(text_buffer_->GetRowDisplayString(ln), 0, client_x);
+  return static_cast<int>(line_widths_.GetColumn(ln, client_x));
 }
 
-int TextPanel::IndexChar(const wxString& line,
-                         int base,
-                         int client_x) const {
-  if (line.IsEmpty())
-    return 0;
+int TextPanel::GetColumnX(int ln, int column) const {
+  return line_widths_.GetX(ln, static_cast<size_t>(std::max(column, 0)));
+}
+
+void TextPanel::SetWordWrap(bool wrap) {
+  if (wrap == wrap_) {
+    return;
+  }
+  ApplyPendingKeys();
+
+  // The row at the top stays there. All rows take a line each until laid
+  // out, so the lines start where the rows were.
+  int top_row = GetRowAtY(GetViewStart().y * line_height_);
+  wrap_ = wrap;
+  if (wrap_) {
+    wrap_width_ = GetWrapWidth();
+    wrap_layout_.Reset(text_buffer_->GetRowCount());
+  }
+  line_tiles_.Clear();
+  RefreshRows(0, TextBuffer::kAllRowsAfter);
+  UpdateVirtualSize();
+  Scroll(0, GetRowTop(top_row) / line_height_);
+  UpdateCaretPosition();
+}
 
-  if (base >= static_cast<int>(line.Length()))
-      return 0;
+int TextPanel::GetWrapWidth() const {
+  // Room is left for the caret after the last char.
+  int client_width = 0;
+  int client_height = 0;
+  GetClientSize(&client_width, &client_height);
+  return std::max(client_width - char_size_.x, char_size_.x);
+}
 
-  return IndexCharRecursively(line, base, 0, line.Length() - base, client_x);
+size_t TextPanel::GetWrapColumns() const {
+  return static_cast<size_t>(
+      std::max(wrap_width_ / std::max(char_size_.x, 1), 1));
 }
 
-int TextPanel::IndexCharRecursively(const wxString& line,
-                                    int base,
-                                    int begin,
-                                    int end,
-                                    int client_x) const {
-  if (begin >= end) {
-    return begin;
+void TextPanel::GetWrapStarts(int row,
+                              TextView line,
+                              std::vector<size_t>* starts) const {
+  starts->assign(1, 0);
+  // Most rows fit, measuring them needs no offsets.
+  if (char_widths_.GetWidth(line.data(), line.size()) <= wrap_width_) {
+    return;
   }
 
-  int m = begin + (end - begin) / 2;
-  int width = GetLineWidth(line, 0, m, base);
+  size_t len = line.size();
+  size_t start = 0;
+  while (true) {
+    // The last column that fits, a line holds a char at least.
+    int left = line_widths_.GetX(row, start);
+    size_t low = start + 1;
+    size_t high = len;
+    while (low < high) {
+      size_t middle = low + (high - low + 1) / 2;
+      if (line_widths_.GetX(row, middle) - left <= wrap_width_) {
+        low = middle;
+      } else {
+        high = middle - 1;
+      }
+    }
+    size_t end = low;
+    if (end >= len) {
+      return;
+    }
 
-  if (abs(width - client_x) < (char_size_.x / 2)) {
-    return m;
-  } else if (client_x > width) {
-    return IndexCharRecursively(line, base, m + 1, end, client_x);
-  } else {  // client_x < width
-    return IndexCharRecursively(line, base, begin, m, client_x);
+    if (line[end] == kSpaceChar || line[end] == kTabChar) {
+      // The space hangs at the end of the line.
+      ++end;
+    } else {
+      size_t space = end;
+      while (space > start && line[space - 1] != kSpaceChar
+             && line[space - 1] != kTabChar) {
+        --space;
+      }
+      if (space > start) {
+        end = space;
+      } else if (IsLowSurrogate(line[end])) {
+        // Not inside a surrogate pair.
+        end = end > start + 1 ? end - 1 : end + 1;
+      }
+    }
+    if (end >= len) {
+      return;
+    }
+    starts->push_back(end);
+    start = end;
   }
 }
 
-int TextPanel::GetLineWidth(const wxString& line,
-                            int off,
-                            int len,
-                            int base) const {
-  return GetWidth(line.t_str(), base + off, len);
+void TextPanel::LayOutRow(int row) {
+  if (wrap_layout_.IsLaidOut(row)) {
+    return;
+  }
+  size_t len = static_cast<size_t>(
+      text_buffer_->GetRowDisplayCharCount(row));
+  int lines = 1;
+  if (len >= kMinCharWrappedLength) {
+    size_t columns = GetWrapColumns();
+    lines = static_cast<int>((len + columns - 1) / columns);
+  } else {
+    TextView line = text_buffer_->GetRowDisplayView(row);
+    GetWrapStarts(row, line, &wrap_starts_);
+    lines = static_cast<int>(wrap_starts_.size());
+  }
+  if (lines != wrap_layout_.GetRowLines(row)) {
+    // The rows after it moved.
+    layout_changed_ = true;
+    RefreshRows(row, TextBuffer::kAllRowsAfter);
+  }
+  wrap_layout_.SetRowLines(row, lines);
+}
+
+void TextPanel::LayOutLines(int first_line, int last_line) {
+  int row_count = wrap_layout_.GetRowCount();
+  int first = 0;
+  int row = wrap_layout_.GetRowAt(first_line, &first);
+  for (; row < row_count; ++row) {
+    // Laying out a row moves the rows after it, they are looked up anew.
+    LayOutRow(row);
+    if (wrap_layout_.GetFirstLine(row + 1) > last_line) {
+      break;
+    }
+  }
+}
+
+void TextPanel::LayOutVisibleLines() {
+  int client_width = 0;
+  int client_height = 0;
+  GetClientSize(&client_width, &client_height);
+  int first_line = GetViewStart().y;
+  LayOutLines(first_line, first_line + client_height / line_height_ + 1);
+}
+
+bool TextPanel::LayOutStaleRows() {
+  // The row at the top and its line in the window are kept.
+  int view_line = GetViewStart().y;
+  int first_line = 0;
+  int top_row = wrap_layout_.GetRowAt(view_line, &first_line);
+  int top_offset = view_line - first_line;
+
+  for (int count = 0; count < kMaxRowsLaidOutAtOnce; ++count) {
+    int row = wrap_layout_.GetFirstStaleRow();
+    if (row < 0) {
+      break;
+    }
+    LayOutRow(row);
+  }
+
+  int line = wrap_layout_.GetFirstLine(top_row)
+      + std::min(top_offset, wrap_layout_.GetRowLines(top_row) - 1);
+  if (layout_changed_) {
+    UpdateVirtualSize();
+  }
+  if (line != view_line) {
+    // The rows above moved the row at the top, scroll after it.
+    Scroll(-1, line);
+    RefreshRows(0, TextBuffer::kAllRowsAfter);
+  }
+  return wrap_layout_.GetFirstStaleRow() >= 0;
+}
+
+void TextPanel::OnIdle(wxIdleEvent& evt) {
+  if (wrap_ && LayOutStaleRows()) {
+    evt.RequestMore();
+  }
+  evt.Skip();
+}
+
+int TextPanel::GetRowTop(int row) const {
+  if (wrap_) {
+    return wrap_layout_.GetFirstLine(row) * line_height_;
+  }
+  return row * line_height_;
+}
+
+int TextPanel::GetRowAtY(int y) const {
+  int line = std::max(y, 0) / std::max(line_height_, 1);
+  if (wrap_) {
+    int first_line = 0;
+    return wrap_layout_.GetRowAt(line, &first_line);
+  }
+  return line;
 }
 
-int TextPanel::GetWidth(const std::wstring& text, int off, int len) const {
+int TextPanel::GetPointLine(const wxPoint& point, int* x) {
+  if (!wrap_) {
+    *x = GetColumnX(point.y, point.x);
+    return point.y;
+  }
+
+  LayOutRow(point.y);
+  // A column at the start of a line is on that line.
+  size_t column = static_cast<size_t>(std::max(point.x, 0));
+  size_t len = static_cast<size_t>(
+      text_buffer_->GetRowDisplayCharCount(point.y));
+  size_t index = 0;
+  size_t start = 0;
+  if (len >= kMinCharWrappedLength) {
+    size_t columns = GetWrapColumns();
+    // The end of the row is on its last line.
+    index = std::min(column, len - 1) / columns;
+    start = index * columns;
+  } else {
+    TextView line = text_buffer_->GetRowDisplayView(point.y);
+    GetWrapStarts(point.y, line, &wrap_starts_);
+    index = std::upper_bound(wrap_starts_.begin(), wrap_starts_.end(),
+                             column) - wrap_starts_.begin() - 1;
+    start = wrap_starts_[index];
+  }
+  *x = line_widths_.GetX(point.y, column) - line_widths_.GetX(point.y, start);
+  return wrap_layout_.GetFirstLine(point.y) + static_cast<int>(index);
+}
+
+wxPoint TextPanel::GetLinePoint(int line, int x) {
+  int first_line = 0;
+  int row = wrap_layout_.GetRowAt(line, &first_line);
+  LayOutRow(row);
+  first_line = wrap_layout_.GetFirstLine(row);
+
+  size_t index = static_cast<size_t>(std::max(line - first_line, 0));
+  size_t len = static_cast<size_t>(
+      text_buffer_->GetRowDisplayCharCount(row));
+  size_t start = 0;
+  size_t end = len;
+  if (len >= kMinCharWrappedLength) {
+    // The caret stays before the last char of a line the row goes on
+    // after, past it the caret would be on the next line.
+    size_t columns = GetWrapColumns();
+    index = std::min(index, (len - 1) / columns);
+    start = index * columns;
+    if (start + columns < len) {
+      end = start + columns - 1;
+    }
+  } else {
+    TextView text = text_buffer_->GetRowDisplayView(row);
+    GetWrapStarts(row, text, &wrap_starts_);
+    index = std::min(index, wrap_starts_.size() - 1);
+    start = wrap_starts_[index];
+    if (index + 1 < wrap_starts_.size()) {
+      end = wrap_starts_[index + 1] - 1;
+      if (end > start && IsLowSurrogate(text[end])) {
+        --end;
+      }
+    }
+  }
+  int left = line_widths_.GetX(row, start);
+  size_t column = line_widths_.GetColumn(row, left + x);
+  column = std::max(std::min(column, end), start);
+  return wxPoint(static_cast<int>(column), row);
+}
+
+void TextPanel::MoveCaretLines(int delta) {
+  // The keys applied so far may have changed rows.
+  RefreshChangedRows();
   int x = 0;
-  wxMemoryDC dc;
-  dc.SetFont(GetFont());
-  dc.GetTextExtent(wxString(text.c_str() + off, len), &x, nullptr, 0, nullptr);
-  return x;
+  int line = GetPointLine(click_position_, &x);
+  click_position_ = GetLinePoint(std::max(line + delta, 0), x);
 }
 
 void TextPanel::InsertChar(wxChar c) {
   wxPoint point = click_position_;
-  InsertChar(point, c, kForward);
+  InsertChar(point, c);
 }
 
-void TextPanel::InsertChar(const wxPoint& point, wxChar c, ActionDir dir) {
-  click_position_ = text_buffer_->InsertChar(point, c, dir);
-  UpdateCaretPoint(click_position_);
+void TextPanel::InsertChar(const wxPoint& point, wxChar c) {
+  SetCaretPoint(text_buffer_->InsertChar(point, c));
 }
 
 void TextPanel::DeleteChar(ActionDir dir) {
-  click_position_ = text_buffer_->DeleteChar(click_position_, dir);
+  SetCaretPoint(text_buffer_->DeleteChar(click_position_, dir));
+}
+
+void TextPanel::InsertText(const wxString& text) {
+  ApplyPendingKeys();
+  click_position_ = text_buffer_->InsertText(
+      click_position_, TextView(text.wc_str(), text.length()));
+  RefreshChangedRows();
+  UpdateVirtualSize();
+  UpdateCaretPoint(click_position_);
+}
+
+void TextPanel::DeleteRange(const wxPoint& from, const wxPoint& to) {
+  ApplyPendingKeys();
+  click_position_ = text_buffer_->DeleteRange(from, to);
+  RefreshChangedRows();
+  UpdateVirtualSize();
   UpdateCaretPoint(click_position_);
 }
 
+void TextPanel::BeginUndoGroup() {
+  ApplyPendingKeys();
+  text_buffer_->BeginUndoGroup();
+}
+
+void TextPanel::EndUndoGroup() {
+  ApplyPendingKeys();
+  text_buffer_->EndUndoGroup();
+}
+
 void TextPanel::DoUndo() {
+  ApplyPendingKeys();
   text_buffer_->DoUndo();
+  RefreshChangedRows();
+  UpdateVirtualSize();
   UpdateCaretPoint(text_buffer_->new_caret_position());
 }
 
 void TextPanel::DoRedo() {
+  ApplyPendingKeys();
   text_buffer_->DoRedo();
+  RefreshChangedRows();
+  UpdateVirtualSize();
   UpdateCaretPoint(text_buffer_->new_caret_position());
 }
 
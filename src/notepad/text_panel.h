@@ -1,21 +1,39 @@
 #ifndef NOTEPAD_NOTEPAD_TEXT_PANEL_H_
 #define NOTEPAD_NOTEPAD_TEXT_PANEL_H_
 
+#include <string>
+#include <vector>
+
+#include "wx/dc.h"
 #include "wx/panel.h"
 #include "wx/pen.h"
 #include "wx/scrolwin.h"
+#include "wx/stopwatch.h"
 #include "wx/timer.h"
 
+#include "notepad/char_widths.h"
 #include "notepad/defs.h"
+#include "notepad/file_loader.h"
+#include "notepad/highlighter.h"
+#include "notepad/line_tiles.h"
+#include "notepad/line_widths.h"
+#include "notepad/task_scheduler.h"
 #include "notepad/text_buffer.h"
+#include "notepad/wrap_layout.h"
 
 namespace csi_training {
 
+enum {
+  ID_Frame_Timer = wxID_HIGHEST + 21
+};
+
 class TextPanel : public wxScrolledWindow {
   DECLARE_EVENT_TABLE()
 
  public:
+  // The background work of the panel runs on the scheduler.
   TextPanel(TextBuffer* buffer,
+            TaskScheduler* scheduler,
             wxWindow* parent,
             wxWindowID winid = wxID_ANY,
             const wxPoint& pos = wxDefaultPosition,
@@ -27,9 +45,29 @@ class TextPanel : public wxScrolledWindow {
 
   void Init();
   void Clear();
+  // Big files are loaded in the background, their rows are shown as they
+  // arrive.
   void LoadFile(const wxString& file);
-  void SaveFile(const wxString& file);
 
+  // Takes a snapshot of the text to save, with the keys typed so far,
+  // nullptr while loading.
+  std::shared_ptr<const TextSnapshot> TakeSnapshot();
+
+  bool IsLoading() const;
+  // Stops loading and clears the partly loaded file.
+  void CancelLoad();
+
+  // Inserts the text at the caret, or deletes the text between the points,
+  // in one edit that is undone at once. The caret ends after the inserted
+  // text or where the deleted one started.
+  void InsertText(const wxString& text);
+  void DeleteRange(const wxPoint& from, const wxPoint& to);
+
+  // Groups the edits in between into one undo step.
+  void BeginUndoGroup();
+  void EndUndoGroup();
+
+  // Undoes/redoes a whole step with a single caret update and repaint.
   void DoUndo();
   void DoRedo();
   bool CanUndo() const;
@@ -37,6 +75,17 @@ class TextPanel : public wxScrolledWindow {
 
   void UpdateVirtualSize();
 
+  // Wraps the rows at the width of the window, scrolling only vertically.
+  // The caret and the scrollbars then work in lines on screen.
+  void SetWordWrap(bool wrap);
+  bool IsWordWrap() const { return wrap_; }
+
+  // Moves the pixels of the window, the caret follows its char.
+  void ScrollWindow(int dx, int dy, const wxRect* rect = nullptr) override;
+
+  // Paints the rows in rect, which is in unscrolled coordinates.
+  void Paint(wxDC& dc, const wxRect& rect);  // NOLINT
+
  protected:
   void OnPaint(wxPaintEvent& evt);  // NOLINT
   void OnSize(wxSizeEvent& evt);  // NOLINT
@@ -47,6 +96,16 @@ class TextPanel : public wxScrolledWindow {
   void OnMouseCaptureLost(wxMouseCaptureLostEvent& evt);  // NOLINT
   void OnChar(wxKeyEvent& evt);  // NOLINT
   void OnScroll(wxScrollWinEvent& event);  // NOLINT
+  // Scrolls to the last position dragged to.
+  void ScrollToPending();
+  void OnLoaderLines(wxThreadEvent& evt);  // NOLINT
+  void OnLoaderDone(wxThreadEvent& evt);  // NOLINT
+  void OnFrameTimer(wxTimerEvent& evt);  // NOLINT
+  void OnIdle(wxIdleEvent& evt);  // NOLINT
+  void OnHighlighterStates(wxThreadEvent& evt);  // NOLINT
+
+  // Stops the file loader thread, if any, and waits for it.
+  void StopLoader();
 
   void DoMouseLeftDown(wxMouseEvent& evt);  // NOLINT
   void DoMouseLeftUp(wxMouseEvent& evt);  // NOLINT
@@ -63,10 +122,75 @@ class TextPanel : public wxScrolledWindow {
 
   // Sets new caret point and update caret position.
   void UpdateCaretPoint(const wxPoint& point);
+  // Sets new caret point, clamped to the text, without moving the caret.
+  void SetCaretPoint(const wxPoint& point);
 
   // Sets caret position according to current caret point.
   void UpdateCaretPosition();
 
+  // Paints the rows in rect wrapped, rect is in unscrolled coordinates.
+  void PaintWrapped(wxDC& dc, const wxRect& rect);  // NOLINT
+
+  // Gets the bitmap of the row, drawing it if it changed since it was drawn
+  // last.
+  wxBitmap GetLineTile(int row, TextView line);
+  // Draws the columns [first, last) of the row with column first at (x, y),
+  // in the colours of their tokens once the state the row starts in is
+  // known. line holds the chars of the row from column line_start on, it
+  // is drawn plain unless it holds the whole row.
+  void DrawLine(wxDC& dc,  // NOLINT
+                int row,
+                TextView line,
+                size_t line_start,
+                size_t first,
+                size_t last,
+                int x,
+                int y);
+
+  // Gets the width rows are wrapped at, that of the window.
+  int GetWrapWidth() const;
+  // Sets *starts to the columns the lines of the wrapped row start at, the
+  // first is 0. Rows break after spaces, or anywhere in longer words.
+  // Only for rows shorter than kMinCharWrappedLength.
+  void GetWrapStarts(int row, TextView line,
+                     std::vector<size_t>* starts) const;
+  // Gets the chars per line of the rows of kMinCharWrappedLength or more,
+  // they are wrapped every so many chars without being measured.
+  size_t GetWrapColumns() const;
+  // Lays out the row if it is stale. The rows after it are repainted if its
+  // line count changed.
+  void LayOutRow(int row);
+  // Lays out the rows holding the lines [first_line, last_line], and those
+  // in the window.
+  void LayOutLines(int first_line, int last_line);
+  void LayOutVisibleLines();
+  // Lays out some of the stale rows, keeping the row at the top of the
+  // window in place. Returns true if rows are left.
+  bool LayOutStaleRows();
+
+  // Gets the y of the top of the row, in unscrolled coordinates.
+  int GetRowTop(int row) const;
+  // Gets the row at y, in unscrolled coordinates.
+  int GetRowAtY(int y) const;
+  // Gets the line on screen of the point and sets *x to its x.
+  int GetPointLine(const wxPoint& point, int* x);
+  // Gets the point nearest to x in the line on screen.
+  wxPoint GetLinePoint(int line, int x);
+  // Moves the caret up or down lines on screen, keeping its x.
+  void MoveCaretLines(int delta);
+
+  // Repaints the rows the last edits of the buffer changed, moving the caret
+  // repaints nothing.
+  void RefreshChangedRows();
+  // Adds rows [first_row, last_row] to the damage repainted once the event
+  // is handled, last_row may be TextBuffer::kAllRowsAfter.
+  void RefreshRows(int first_row, int last_row);
+  void RefreshDamage();
+  // Repaints the rows the highlighter colours differently now.
+  void RefreshChangedStates();
+  // Gets the last row in the window.
+  int GetLastVisibleRow() const;
+
   void HandleLeftDownNoAccel();
 
   bool HandleSpecialKeyDown(wxKeyEvent& evt);  // NOLINT
@@ -76,41 +200,78 @@ class TextPanel : public wxScrolledWindow {
 
   // Gets the index of the char at position client_x
   int GetCharIndex(int ln, int client_x) const;
-
-  // Binary search to get the char index with the given client x coordinate.
-  int IndexChar(const wxString& line,
-                int base,
-                int client_x) const;
-
-  // Binary search to get the char index.
-  // The range is STL-style: [begin, end).
-  // Called by IndexChar().
-  int IndexCharRecursively(const wxString& line,
-                           int base,
-                           int begin,
-                           int end,
-                           int client_x) const;
-
-  // Get the sub line width.
-  int GetLineWidth(const wxString& line,
-                   int off,
-                   int len,
-                   int base = 0) const;
-
-  int GetWidth(const std::wstring& text, int off, int len) const;
+  // Gets the x of the char at column in the row.
+  int GetColumnX(int ln, int column) const;
 
   // Insert a char at the caret point.
   void InsertChar(wxChar c);
-  void InsertChar(const wxPoint& point, wxChar c, ActionDir dir);
+  void InsertChar(const wxPoint& point, wxChar c);
 
   void DeleteChar(ActionDir dir);
 
+  // A key pressed, applied at the next frame. code is WXK_NONE for a char.
+  struct PendingKey {
+    int code;
+    wxChar c;
+  };
+
+  // Keys are queued and applied together at the next frame, the virtual
+  // size, the caret and the damage are updated once for all of them.
+  void QueueKey(int code, wxChar c);
+  // Applies the keys queued, before anything else changes the buffer.
+  void ApplyPendingKeys();
+  void ApplyKey(const PendingKey& key);
+
  private:
   TextBuffer* text_buffer_;
+  TaskScheduler* scheduler_;
   wxSize char_size_;
+  // The advances of the chars in the font, measuring text and hitting chars
+  // need no DC.
+  CharWidths char_widths_;
+  // The x of the chars of the rows used lately, rows are forgotten when
+  // they are edited.
+  mutable LineWidths line_widths_;
+  // The bitmaps of the short rows drawn lately.
+  LineTiles line_tiles_;
+  // The rows shown are lexed when painted, the rest in the background.
+  Highlighter highlighter_;
+
+  // The line counts of the wrapped rows, kept only while wrapping. Stale
+  // rows are laid out when shown, and the others when idle.
+  bool wrap_;
+  int wrap_width_;
+  WrapLayout wrap_layout_;
+  // Set when line counts changed, the virtual size is updated with the
+  // next repaint.
+  bool layout_changed_;
+  std::vector<size_t> wrap_starts_;
   wxPoint click_position_;
   int line_height_;
   int line_padding_;  // Spacing at the top and bottom of a line.
+
+  FileLoader* file_loader_;
+  // Tells the events of the current load from those of cancelled ones.
+  int load_id_;
+
+  // The rows to repaint, none if damaged_first_row_ is -1.
+  int damaged_first_row_;
+  int damaged_last_row_;
+
+  // The position a scrollbar is dragged to, -1 if it isn't.
+  wxPoint pending_scroll_;
+  bool scroll_pending_;
+
+  wxTimer frame_timer_;
+  // Time since the first key pending was queued.
+  wxStopWatch frame_watch_;
+  std::vector<PendingKey> pending_keys_;
+
+  // Reused for the strings passed to the DC, so painting doesn't allocate
+  // once its capacity is large enough.
+  wxString paint_text_;
+  // Holds the slices of long rows drawn when they span several pieces.
+  std::wstring slice_text_;
 };
 
 }  // namespace csi_training
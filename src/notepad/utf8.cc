@@ -0,0 +1,186 @@
+#include "notepad/utf8.h"
+
+#include <cstring>
+
+namespace csi_training {
+
+// Gets the length of the valid sequence at data and its code point, or 0 if
+// the byte at data doesn't start one.
+static size_t DecodeSequence(const unsigned char* data,
+                             size_t len,
+                             unsigned int* code_point) {
+  unsigned char lead = data[0];
+  size_t count = 0;
+  unsigned int cp = 0;
+  unsigned int min_cp = 0;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    count = 2;
+    cp = lead & 0x1F;
+    min_cp = 0x80;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    count = 3;
+    cp = lead & 0x0F;
+    min_cp = 0x800;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    count = 4;
+    cp = lead & 0x07;
+    min_cp = 0x10000;
+  } else {
+    return 0;
+  }
+
+  if (count > len) {
+    return 0;
+  }
+  for (size_t i = 1; i < count; ++i) {
+    if ((data[i] & 0xC0) != 0x80) {
+      return 0;
+    }
+    cp = (cp << 6) | (data[i] & 0x3F);
+  }
+  if (cp < min_cp || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+    return 0;
+  }
+
+  *code_point = cp;
+  return count;
+}
+
+// Gets the count of wxChars a code point takes.
+static size_t CharCount(unsigned int code_point) {
+  if (sizeof(wxChar) == 2 && code_point > 0xFFFF) {
+    return 2;  // a surrogate pair
+  }
+  return 1;
+}
+
+// Gets the count of leading ASCII bytes.
+static size_t AsciiPrefix(const unsigned char* data, size_t len) {
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    unsigned long long word;  // NOLINT
+    memcpy(&word, data + i, 8);
+    if ((word & 0x8080808080808080ULL) != 0) {
+      break;
+    }
+  }
+  while (i < len && data[i] < 0x80) {
+    ++i;
+  }
+  return i;
+}
+
+bool IsAscii(const char* data, size_t len) {
+  return AsciiPrefix(reinterpret_cast<const unsigned char*>(data), len)
+      == len;
+}
+
+bool IsValidUtf8(const char* data, size_t len) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+  while (i < len) {
+    i += AsciiPrefix(bytes + i, len - i);
+    if (i == len) {
+      break;
+    }
+
+    unsigned int cp = 0;
+    size_t n = DecodeSequence(bytes + i, len - i, &cp);
+    if (n == 0) {
+      return false;
+    }
+    i += n;
+  }
+  return true;
+}
+
+size_t Utf8DecodedLength(const char* data, size_t len) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  size_t count = 0;
+  size_t i = 0;
+  while (i < len) {
+    size_t ascii = AsciiPrefix(bytes + i, len - i);
+    count += ascii;
+    i += ascii;
+    if (i == len) {
+      break;
+    }
+
+    unsigned int cp = 0;
+    size_t n = DecodeSequence(bytes + i, len - i, &cp);
+    if (n == 0) {
+      ++count;
+      ++i;
+    } else {
+      count += CharCount(cp);
+      i += n;
+    }
+  }
+  return count;
+}
+
+void Utf8Decode(const char* data, size_t len, std::wstring* text) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+  while (i < len) {
+    size_t ascii = AsciiPrefix(bytes + i, len - i);
+    text->append(bytes + i, bytes + i + ascii);
+    i += ascii;
+    if (i == len) {
+      break;
+    }
+
+    unsigned int cp = 0;
+    size_t n = DecodeSequence(bytes + i, len - i, &cp);
+    if (n == 0) {
+      text->push_back(static_cast<wxChar>(bytes[i]));
+      ++i;
+    } else if (CharCount(cp) == 2) {
+      cp -= 0x10000;
+      text->push_back(static_cast<wxChar>(0xD800 + (cp >> 10)));
+      text->push_back(static_cast<wxChar>(0xDC00 + (cp & 0x3FF)));
+      i += n;
+    } else {
+      text->push_back(static_cast<wxChar>(cp));
+      i += n;
+    }
+  }
+}
+
+void Utf8Encode(const wxChar* text, size_t len, std::string* bytes) {
+  size_t i = 0;
+  while (i < len) {
+    size_t ascii = i;
+    while (ascii < len && static_cast<unsigned int>(text[ascii]) < 0x80) {
+      ++ascii;
+    }
+    bytes->append(text + i, text + ascii);
+    i = ascii;
+    if (i == len) {
+      break;
+    }
+
+    unsigned int cp = static_cast<unsigned int>(text[i++]);
+    if (cp >= 0xD800 && cp <= 0xDBFF && i < len) {
+      unsigned int low = static_cast<unsigned int>(text[i]);
+      if (low >= 0xDC00 && low <= 0xDFFF) {
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        ++i;
+      }
+    }
+
+    if (cp < 0x800) {
+      bytes->push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    } else if (cp < 0x10000) {
+      bytes->push_back(static_cast<char>(0xE0 | (cp >> 12)));
+      bytes->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    } else {
+      bytes->push_back(static_cast<char>(0xF0 | (cp >> 18)));
+      bytes->push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+      bytes->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    }
+    bytes->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+}
+
+}  // namespace csi_training
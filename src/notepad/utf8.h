@@ -0,0 +1,35 @@
+#ifndef NOTEPAD_NOTEPAD_UTF8_H_
+#define NOTEPAD_NOTEPAD_UTF8_H_
+
+#include <string>
+
+#include "wx/defs.h"
+
+namespace csi_training {
+
+// UTF-8 helpers for text that is decoded lazily.
+// A byte that does not start a valid sequence decodes to one char with the
+// same value, as in Latin-1, so any byte string can be decoded and both
+// functions below always agree on the length.
+
+// Gets whether the bytes are all ASCII, each decodes to the char of its
+// value then.
+bool IsAscii(const char* data, size_t len);
+
+// Gets whether the bytes are all valid sequences, so none is decoded as
+// Latin-1 and encoding the decoded chars gives the bytes back.
+bool IsValidUtf8(const char* data, size_t len);
+
+// Gets the count of wxChars the bytes decode to.
+size_t Utf8DecodedLength(const char* data, size_t len);
+
+// Decodes the bytes and appends them to text.
+void Utf8Decode(const char* data, size_t len, std::wstring* text);
+
+// Encodes the chars and appends them to bytes. Surrogate pairs are joined,
+// lone surrogates are encoded like any other char.
+void Utf8Encode(const wxChar* text, size_t len, std::string* bytes);
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_UTF8_H_
@@ -0,0 +1,301 @@
+#include "notepad/wrap_layout.h"
+
+#include <algorithm>
+
+namespace csi_training {
+
+WrapLayout::WrapLayout()
+    : root_(nullptr)
+    , layout_id_(1)
+    , seed_(2463534242u) {
+  Reset(1);
+}
+
+WrapLayout::~WrapLayout() {
+  DeleteTree(root_);
+}
+
+void WrapLayout::Reset(int row_count) {
+  DeleteTree(root_);
+  Run run = { row_count, 1, 0 };
+  root_ = NewNode(run);
+}
+
+void WrapLayout::ApplyRowEdit(int row, int old_count, int new_count) {
+  Node* left = nullptr;
+  Node* middle = nullptr;
+  Node* right = nullptr;
+  Split(root_, row, &left, &right);
+  Split(right, old_count, &middle, &right);
+
+  if (old_count == new_count) {
+    // Rows edited in place keep their counts until they are laid out, the
+    // rows after them likely stay where they are.
+    MarkStale(middle);
+  } else {
+    DeleteTree(middle);
+    middle = nullptr;
+    if (new_count > 0) {
+      Run run = { new_count, 1, 0 };
+      middle = NewNode(run);
+    }
+  }
+  root_ = MergeRuns(MergeRuns(left, middle), right);
+}
+
+void WrapLayout::Invalidate() {
+  ++layout_id_;
+}
+
+int WrapLayout::GetRowCount() const {
+  return Rows(root_);
+}
+
+int WrapLayout::GetLineCount() const {
+  return Lines(root_);
+}
+
+int WrapLayout::GetFirstLine(int row) const {
+  if (row >= GetRowCount()) {
+    return GetLineCount();
+  }
+  int run_row = 0;
+  int run_line = 0;
+  const Node* node = FindRow(row, &run_row, &run_line);
+  return run_line + (row - run_row) * node->run.lines;
+}
+
+int WrapLayout::GetRowAt(int line, int* first_line) const {
+  line = std::max(std::min(line, GetLineCount() - 1), 0);
+  const Node* node = root_;
+  int row = 0;
+  int base_line = 0;
+  while (node != nullptr) {
+    int left_lines = Lines(node->left);
+    int run_lines = node->run.rows * node->run.lines;
+    if (line < base_line + left_lines) {
+      node = node->left;
+    } else if (line < base_line + left_lines + run_lines) {
+      int run_line = base_line + left_lines;
+      int index = (line - run_line) / node->run.lines;
+      *first_line = run_line + index * node->run.lines;
+      return row + Rows(node->left) + index;
+    } else {
+      row += Rows(node->left) + node->run.rows;
+      base_line += left_lines + run_lines;
+      node = node->right;
+    }
+  }
+  *first_line = 0;
+  return 0;
+}
+
+int WrapLayout::GetRowLines(int row) const {
+  int run_row = 0;
+  int run_line = 0;
+  return FindRow(row, &run_row, &run_line)->run.lines;
+}
+
+bool WrapLayout::IsLaidOut(int row) const {
+  int run_row = 0;
+  int run_line = 0;
+  return FindRow(row, &run_row, &run_line)->run.layout_id == layout_id_;
+}
+
+void WrapLayout::SetRowLines(int row, int lines) {
+  Node* left = nullptr;
+  Node* middle = nullptr;
+  Node* right = nullptr;
+  Split(root_, row, &left, &right);
+  Split(right, 1, &middle, &right);
+
+  // A single row is a single run.
+  middle->run.lines = std::max(lines, 1);
+  middle->run.layout_id = layout_id_;
+  Update(middle);
+  root_ = MergeRuns(MergeRuns(left, middle), right);
+}
+
+int WrapLayout::GetFirstStaleRow() const {
+  const Node* node = root_;
+  if (node == nullptr || node->min_layout_id >= layout_id_) {
+    return -1;
+  }
+  int row = 0;
+  while (node != nullptr) {
+    if (node->left != nullptr && node->left->min_layout_id < layout_id_) {
+      node = node->left;
+    } else if (node->run.layout_id < layout_id_) {
+      return row + Rows(node->left);
+    } else {
+      row += Rows(node->left) + node->run.rows;
+      node = node->right;
+    }
+  }
+  return -1;
+}
+
+WrapLayout::Node* WrapLayout::NewNode(const Run& run) {
+  // xorshift32, a fixed seed keeps the tree shape reproducible.
+  seed_ ^= seed_ << 13;
+  seed_ ^= seed_ >> 17;
+  seed_ ^= seed_ << 5;
+  return new Node(run, seed_);
+}
+
+void WrapLayout::DeleteTree(Node* node) {
+  if (node != nullptr) {
+    DeleteTree(node->left);
+    DeleteTree(node->right);
+    delete node;
+  }
+}
+
+void WrapLayout::MarkStale(Node* node) {
+  if (node != nullptr) {
+    MarkStale(node->left);
+    MarkStale(node->right);
+    node->run.layout_id = 0;
+    Update(node);
+  }
+}
+
+void WrapLayout::Update(Node* node) {
+  node->rows = Rows(node->left) + node->run.rows + Rows(node->right);
+  node->lines = Lines(node->left) + node->run.rows * node->run.lines
+      + Lines(node->right);
+  node->min_layout_id = node->run.layout_id;
+  if (node->left != nullptr) {
+    node->min_layout_id = std::min(node->min_layout_id,
+                                   node->left->min_layout_id);
+  }
+  if (node->right != nullptr) {
+    node->min_layout_id = std::min(node->min_layout_id,
+                                   node->right->min_layout_id);
+  }
+}
+
+const WrapLayout::Node* WrapLayout::FindRow(int row,
+                                            int* run_row,
+                                            int* run_line) const {
+  row = std::max(std::min(row, GetRowCount() - 1), 0);
+  const Node* node = root_;
+  *run_row = 0;
+  *run_line = 0;
+  while (true) {
+    int left_rows = Rows(node->left);
+    if (row < *run_row + left_rows) {
+      node = node->left;
+    } else if (row < *run_row + left_rows + node->run.rows) {
+      *run_row += left_rows;
+      *run_line += Lines(node->left);
+      return node;
+    } else {
+      *run_row += left_rows + node->run.rows;
+      *run_line += Lines(node->left) + node->run.rows * node->run.lines;
+      node = node->right;
+    }
+  }
+}
+
+void WrapLayout::Split(Node* node, int rows, Node** left, Node** right) {
+  if (node == nullptr) {
+    *left = nullptr;
+    *right = nullptr;
+    return;
+  }
+
+  int left_rows = Rows(node->left);
+  if (rows <= left_rows) {
+    Split(node->left, rows, left, &node->left);
+    Update(node);
+    *right = node;
+    return;
+  }
+
+  int run_end = left_rows + node->run.rows;
+  if (rows >= run_end) {
+    Split(node->right, rows - run_end, &node->right, right);
+    Update(node);
+    *left = node;
+    return;
+  }
+
+  // The split is inside this run, cut it in two.
+  Run tail = node->run;
+  node->run.rows = rows - left_rows;
+  tail.rows -= node->run.rows;
+
+  // Keep the priority so the heap order still holds in the right tree.
+  Node* tail_node = new Node(tail, node->priority);
+  tail_node->right = node->right;
+  node->right = nullptr;
+  Update(tail_node);
+  Update(node);
+  *left = node;
+  *right = tail_node;
+}
+
+WrapLayout::Node* WrapLayout::Merge(Node* left, Node* right) {
+  if (left == nullptr) {
+    return right;
+  }
+  if (right == nullptr) {
+    return left;
+  }
+
+  if (left->priority > right->priority) {
+    left->right = Merge(left->right, right);
+    Update(left);
+    return left;
+  } else {
+    right->left = Merge(left, right->left);
+    Update(right);
+    return right;
+  }
+}
+
+WrapLayout::Node* WrapLayout::MergeRuns(Node* left, Node* right) {
+  if (left == nullptr || right == nullptr) {
+    return Merge(left, right);
+  }
+
+  const Node* last = left;
+  while (last->right != nullptr) {
+    last = last->right;
+  }
+  const Node* first = right;
+  while (first->left != nullptr) {
+    first = first->left;
+  }
+  if (last->run.lines == first->run.lines
+      && last->run.layout_id == first->run.layout_id) {
+    Run run;
+    right = PopFirst(right, &run);
+    GrowLast(left, run.rows);
+  }
+  return Merge(left, right);
+}
+
+WrapLayout::Node* WrapLayout::PopFirst(Node* node, Run* run) {
+  if (node->left == nullptr) {
+    *run = node->run;
+    Node* right = node->right;
+    delete node;
+    return right;
+  }
+  node->left = PopFirst(node->left, run);
+  Update(node);
+  return node;
+}
+
+void WrapLayout::GrowLast(Node* node, int rows) {
+  if (node->right == nullptr) {
+    node->run.rows += rows;
+  } else {
+    GrowLast(node->right, rows);
+  }
+  Update(node);
+}
+
+}  // namespace csi_training
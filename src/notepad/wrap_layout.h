@@ -0,0 +1,112 @@
+#ifndef NOTEPAD_NOTEPAD_WRAP_LAYOUT_H_
+#define NOTEPAD_NOTEPAD_WRAP_LAYOUT_H_
+
+#include "wx/defs.h"
+
+namespace csi_training {
+
+// Maps the rows of a buffer to the lines they are wrapped into on screen.
+// The line counts of the rows are kept in a treap of runs of rows with the
+// same count, with cached sums, so going from a row to its first line or
+// from a line to its row, and summing the lines, are O(log n).
+// Rows are laid out lazily: new rows and the rows of a previous width are
+// stale, they keep their old count until they are laid out again.
+class WrapLayout {
+  wxDECLARE_NO_COPY_CLASS(WrapLayout);
+
+ public:
+  WrapLayout();
+  ~WrapLayout();
+
+  // Sets the row count, all the rows are stale and take a line each.
+  void Reset(int row_count);
+
+  // Replaces old_count rows from row with new_count stale rows, see
+  // TextBuffer::RowEdit. New rows take a line each until laid out.
+  void ApplyRowEdit(int row, int old_count, int new_count);
+
+  // Makes all the rows stale after the width changed, they keep their
+  // counts until they are laid out again so the view stays put.
+  void Invalidate();
+
+  int GetRowCount() const;
+  int GetLineCount() const;
+
+  // Gets the first line of the row, GetLineCount() for the row count.
+  int GetFirstLine(int row) const;
+  // Gets the row holding the line and sets *first_line to its first line.
+  // The line is clamped to the lines.
+  int GetRowAt(int line, int* first_line) const;
+
+  int GetRowLines(int row) const;
+  bool IsLaidOut(int row) const;
+  // Sets the line count of the row as laid out at the current width.
+  void SetRowLines(int row, int lines);
+
+  // Gets the first stale row, -1 if all rows are laid out.
+  int GetFirstStaleRow() const;
+
+ private:
+  // rows rows of lines lines each, laid out at width layout_id.
+  struct Run {
+    int rows;
+    int lines;
+    unsigned int layout_id;
+  };
+
+  struct Node {
+    Node(const Run& r, unsigned int prio)
+        : run(r), priority(prio), left(nullptr), right(nullptr)
+        , rows(r.rows), lines(r.rows * r.lines)
+        , min_layout_id(r.layout_id) {
+    }
+
+    Run run;
+    unsigned int priority;
+    Node* left;
+    Node* right;
+    // Cached over the subtree.
+    int rows;
+    int lines;
+    unsigned int min_layout_id;
+  };
+
+  Node* NewNode(const Run& run);
+  void DeleteTree(Node* node);
+  // Makes the rows of the tree stale, keeping their counts.
+  static void MarkStale(Node* node);
+
+  static int Rows(const Node* node) {
+    return node != nullptr ? node->rows : 0;
+  }
+  static int Lines(const Node* node) {
+    return node != nullptr ? node->lines : 0;
+  }
+  static void Update(Node* node);
+
+  // Finds the node of the run holding the row, and the row it starts at.
+  const Node* FindRow(int row, int* run_row, int* run_line) const;
+
+  // Splits the tree so that left holds the first rows.
+  void Split(Node* node, int rows, Node** left, Node** right);
+  Node* Merge(Node* left, Node* right);
+  // Merges the trees, joining the runs at the seam if they are alike, so
+  // the tree doesn't grow a node per row laid out.
+  Node* MergeRuns(Node* left, Node* right);
+
+  // Removes the first run of the tree and sets *run to it.
+  Node* PopFirst(Node* node, Run* run);
+  // Adds rows to the last run of the tree.
+  static void GrowLast(Node* node, int rows);
+
+ private:
+  Node* root_;
+  // The width the rows are laid out at now, older ids are stale and 0 is
+  // never laid out.
+  unsigned int layout_id_;
+  unsigned int seed_;
+};
+
+}  // namespace csi_training
+
+#endif  // NOTEPAD_NOTEPAD_WRAP_LAYOUT_H_